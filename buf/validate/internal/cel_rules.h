@@ -17,6 +17,7 @@
 #include "absl/status/status.h"
 #include "buf/validate/internal/cel_validation_rules.h"
 #include "buf/validate/internal/message_factory.h"
+#include "buf/validate/internal/native_rules.h"
 #include "buf/validate/internal/rules.h"
 #include "buf/validate/validate.pb.h"
 #include "google/protobuf/arena.h"
@@ -63,12 +64,13 @@ absl::Status BuildCelRules(
     std::unique_ptr<MessageFactory>& messageFactory,
     bool allowUnknownFields,
     google::protobuf::Arena* arena,
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     const R& rules,
     CelValidationRules& result) {
   // Look for rules on the set fields.
   std::vector<const google::protobuf::FieldDescriptor*> fields;
   google::protobuf::Message* reparsedRules{};
+  const google::protobuf::Message* setRules{};
   if (messageFactory && rules.unknown_fields().field_count() > 0) {
     reparsedRules = messageFactory->messageFactory()
                         ->GetPrototype(messageFactory->descriptorPool()->FindMessageTypeByName(
@@ -86,12 +88,14 @@ absl::Status BuildCelRules(
     }
     result.setRules(reparsedRules, arena);
     reparsedRules->GetReflection()->ListFields(*reparsedRules, &fields);
+    setRules = reparsedRules;
   } else {
     if (!allowUnknownFields && !R::GetReflection()->GetUnknownFields(rules).empty()) {
       return absl::FailedPreconditionError(absl::StrCat("unknown rules in ", rules.GetTypeName()));
     }
     result.setRules(&rules, arena);
     R::GetReflection()->ListFields(rules, &fields);
+    setRules = &rules;
   }
   for (const auto* field : fields) {
     FieldPath rulePath;
@@ -102,9 +106,10 @@ absl::Status BuildCelRules(
       continue;
     }
     const auto& fieldLvl = field->options().GetExtension(buf::validate::predefined);
+    auto native = NewNativeRule(*setRules, field);
     for (const auto& rule : fieldLvl.cel()) {
-      auto status =
-          result.Add(builder, rule.id(), rule.message(), rule.expression(), rulePath, field);
+      auto status = result.Add(
+          compiler, rule.id(), rule.message(), rule.expression(), rulePath, field, native);
       if (!status.ok()) {
         return status;
       }
@@ -19,13 +19,23 @@
 #include "eval/public/containers/field_backed_list_impl.h"
 #include "eval/public/containers/field_backed_map_impl.h"
 #include "eval/public/structs/cel_proto_wrapper.h"
-#include "parser/parser.h"
 
 namespace buf::validate::internal {
 namespace cel = google::api::expr;
 
 namespace {
 
+// Returns true if the native implementation of expr, if any, passes value.
+bool passesNative(RuleContext& ctx, const CompiledRule& expr, const cel::runtime::CelValue& value) {
+  if (expr.native == nullptr) {
+    return false;
+  }
+  if (expr.native->UsesNow()) {
+    return expr.native->PassesAt(value, ctx.now());
+  }
+  return expr.native->Passes(value);
+}
+
 absl::Status ProcessRule(
     RuleContext& ctx,
     const google::api::expr::runtime::BaseActivation& activation,
@@ -92,62 +102,137 @@ cel::runtime::CelValue ProtoFieldToCelValue(
 } // namespace
 
 absl::Status CelValidationRules::Add(
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     Rule rule,
     absl::optional<FieldPath> rulePath,
-    const google::protobuf::FieldDescriptor* ruleField) {
-  auto pexpr_or = cel::parser::Parse(rule.expression());
-  if (!pexpr_or.ok()) {
-    return pexpr_or.status();
+    const google::protobuf::FieldDescriptor* ruleField,
+    std::shared_ptr<const NativeRule> native) {
+  // Standard and predefined rules read their values from the rules message, which is fixed for
+  // the lifetime of this rule set, so bind them into the program as constants.
+  const google::protobuf::Message* rules = nullptr;
+  if (ruleField != nullptr && compiled_->rules.IsMessage()) {
+    rules = compiled_->rules.MessageOrDie();
   }
-  ::cel::expr::ParsedExpr pexpr = std::move(pexpr_or).value();
-  auto expr_or = builder.CreateExpression(&pexpr.expr(), &pexpr.source_info());
+  auto expr_or = compiler.Compile(rule.expression(), rules, ruleField);
   if (!expr_or.ok()) {
     return expr_or.status();
   }
-  std::unique_ptr<cel::runtime::CelExpression> expr = std::move(expr_or).value();
-  exprs_.emplace_back(
-      CompiledRule{std::move(rule), std::move(expr), std::move(rulePath), ruleField});
+  bool usesNow = compiler.References(rule.expression(), "now");
+  compiled_->exprs.emplace_back(CompiledRule{
+      std::move(rule),
+      std::move(expr_or).value(),
+      std::move(rulePath),
+      ruleField,
+      std::move(native),
+      ruleValue(ruleField),
+      usesNow});
   return absl::OkStatus();
 }
 
 absl::Status CelValidationRules::Add(
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     std::string_view id,
     std::string_view message,
     std::string_view expression,
     absl::optional<FieldPath> rulePath,
-    const google::protobuf::FieldDescriptor* ruleField) {
+    const google::protobuf::FieldDescriptor* ruleField,
+    std::shared_ptr<const NativeRule> native) {
   Rule rule;
   *rule.mutable_id() = id;
   *rule.mutable_message() = message;
   *rule.mutable_expression() = expression;
-  return Add(builder, rule, std::move(rulePath), ruleField);
+  return Add(compiler, rule, std::move(rulePath), ruleField, std::move(native));
 }
 
 absl::Status CelValidationRules::Add(
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     std::string_view expression,
     absl::optional<FieldPath> rulePath,
     const google::protobuf::FieldDescriptor* ruleField) {  
-  return Add(builder, expression, "", expression, std::move(rulePath), ruleField);
+  return Add(compiler, expression, "", expression, std::move(rulePath), ruleField);
+}
+
+bool CelValidationRules::NativeOnly() const {
+  for (const auto& expr : compiled_->exprs) {
+    if (expr.native == nullptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CelValidationRules::PassesNative(const cel::runtime::CelValue& value) const {
+  for (const auto& expr : compiled_->exprs) {
+    if (expr.native == nullptr || !expr.native->Passes(value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+absl::optional<std::vector<std::pair<const IntSet*, bool>>> CelValidationRules::NativeIntSets()
+    const {
+  std::vector<std::pair<const IntSet*, bool>> sets;
+  for (const auto& expr : compiled_->exprs) {
+    bool negated = false;
+    const IntSet* set = expr.native != nullptr ? expr.native->IntMembership(&negated) : nullptr;
+    if (set == nullptr) {
+      return absl::nullopt;
+    }
+    sets.emplace_back(set, negated);
+  }
+  return sets;
+}
+
+absl::Status CelValidationRules::ValidateCel(
+    RuleContext& ctx, cel::runtime::CelValue thisValue) const {
+  for (const auto& expr : compiled_->exprs) {
+    if (!passesNative(ctx, expr, thisValue)) {
+      cel::runtime::Activation activation;
+      activation.InsertValue("this", thisValue);
+      return ValidateCel(ctx, activation, &thisValue);
+    }
+  }
+  return absl::OkStatus();
 }
 
 absl::Status CelValidationRules::ValidateCel(
-    RuleContext& ctx, google::api::expr::runtime::Activation& activation) const {
-  activation.InsertValue("rules", rules_);
-  activation.InsertValue("now", cel::runtime::CelValue::CreateTimestamp(absl::Now()));
+    RuleContext& ctx,
+    google::api::expr::runtime::Activation& activation,
+    const cel::runtime::CelValue* thisValue) const {
+  const auto& rules = compiled_->rules;
+  activation.InsertValue("rules", rules);
+  bool nowBound = false;
   absl::Status status = absl::OkStatus();
 
-  for (const auto& expr : exprs_) {
-    if (rules_.IsMessage() && expr.ruleField != nullptr) {
-      activation.InsertValue(
-          "rule", ProtoFieldToCelValue(rules_.MessageOrDie(), expr.ruleField, ctx.arena));
+  for (const auto& expr : compiled_->exprs) {
+    bool witnessed = false;
+    if (thisValue != nullptr && expr.native != nullptr) {
+      if (passesNative(ctx, expr, *thisValue)) {
+        continue;
+      }
+      if (expr.native->Fails(*thisValue)) {
+        // Produce the violation from a value that fails the same way, but costs less to check.
+        activation.RemoveValueEntry("this");
+        activation.InsertValue("this", expr.native->Witness());
+        witnessed = true;
+      }
+    }
+    if (expr.ruleValue.has_value()) {
+      activation.InsertValue("rule", *expr.ruleValue);
+    }
+    if (expr.usesNow && !nowBound) {
+      activation.InsertValue("now", cel::runtime::CelValue::CreateTimestamp(ctx.now()));
+      nowBound = true;
     }
     int pos = ctx.violations.size();
     status = ProcessRule(ctx, activation, expr);
-    if (rules_.IsMessage() && expr.ruleField != nullptr && ctx.violations.size() > pos) {
-      ctx.setRuleValue(ProtoField{rules_.MessageOrDie(), expr.ruleField}, pos);
+    if (witnessed) {
+      activation.RemoveValueEntry("this");
+      activation.InsertValue("this", *thisValue);
+    }
+    if (rules.IsMessage() && expr.ruleField != nullptr && ctx.violations.size() > pos) {
+      ctx.setRuleValue(ProtoField{rules.MessageOrDie(), expr.ruleField}, pos);
     }
     if (ctx.shouldReturn(status)) {
       break;
@@ -160,7 +245,63 @@ absl::Status CelValidationRules::ValidateCel(
 
 void CelValidationRules::setRules(
     const google::protobuf::Message* rules, google::protobuf::Arena* arena) {
-  rules_ = cel::runtime::CelProtoWrapper::CreateMessage(rules, arena);
+  compiled_->rules = cel::runtime::CelProtoWrapper::CreateMessage(rules, arena);
+  compiled_->arena = arena;
+}
+
+absl::optional<cel::runtime::CelValue> CelValidationRules::ruleValue(
+    const google::protobuf::FieldDescriptor* ruleField) const {
+  if (ruleField == nullptr || !compiled_->rules.IsMessage() || compiled_->arena == nullptr) {
+    return absl::nullopt;
+  }
+  return ProtoFieldToCelValue(compiled_->rules.MessageOrDie(), ruleField, compiled_->arena);
+}
+
+size_t CelValidationRules::CompiledSpaceUsed() const {
+  if (compiled_.use_count() > 1) {
+    return 0;
+  }
+  size_t size = sizeof(CompiledRules) + compiled_->exprs.capacity() * sizeof(CompiledRule);
+  for (const auto& expr : compiled_->exprs) {
+    size += expr.rule.SpaceUsedLong() - sizeof(expr.rule);
+    if (expr.rulePath.has_value()) {
+      size += expr.rulePath->SpaceUsedLong() - sizeof(*expr.rulePath);
+    }
+  }
+  if (compiled_->ownedRules != nullptr) {
+    size += compiled_->ownedRules->SpaceUsedLong();
+  }
+  if (compiled_->ownedArena != nullptr) {
+    size += compiled_->ownedArena->SpaceUsed();
+  }
+  return size;
+}
+
+void CelValidationRules::Intern(SharedCache<CompiledRules>& cache, std::string_view key) {
+  const google::protobuf::Message* rules =
+      compiled_->rules.IsMessage() ? compiled_->rules.MessageOrDie() : nullptr;
+  const auto* generated = google::protobuf::DescriptorPool::generated_pool();
+  if (rules != nullptr && rules->GetDescriptor()->file()->pool() != generated) {
+    // Reparsed with a custom message factory, so it may refer to predefined rules that only
+    // exist in this factory's pool.
+    return;
+  }
+  if (auto interned = cache.Find(key); interned != nullptr) {
+    compiled_ = std::move(interned);
+    return;
+  }
+  if (rules != nullptr) {
+    compiled_->ownedRules.reset(rules->New());
+    compiled_->ownedRules->CopyFrom(*rules);
+    compiled_->rules =
+        cel::runtime::CelProtoWrapper::CreateMessage(compiled_->ownedRules.get(), nullptr);
+    compiled_->ownedArena = std::make_unique<google::protobuf::Arena>();
+    compiled_->arena = compiled_->ownedArena.get();
+    for (auto& expr : compiled_->exprs) {
+      expr.ruleValue = ruleValue(expr.ruleField);
+    }
+  }
+  compiled_ = cache.Insert(key, std::move(compiled_));
 }
 
 } // namespace buf::validate::internal
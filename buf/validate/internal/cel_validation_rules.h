@@ -14,8 +14,13 @@
 
 #pragma once
 
+#include <memory>
 #include <string_view>
+#include <utility>
+#include <vector>
 
+#include "buf/validate/internal/native_rules.h"
+#include "buf/validate/internal/rule_compiler.h"
 #include "buf/validate/internal/validation_rules.h"
 #include "buf/validate/validate.pb.h"
 #include "eval/public/activation.h"
@@ -27,9 +32,30 @@ namespace buf::validate::internal {
 // A compiled rule expression.
 struct CompiledRule {
   buf::validate::Rule rule;
-  std::unique_ptr<google::api::expr::runtime::CelExpression> expr;
+  // Shared by every rule with the same expression text.
+  std::shared_ptr<const google::api::expr::runtime::CelExpression> expr;
   const absl::optional<FieldPath> rulePath;
   const google::protobuf::FieldDescriptor* ruleField;
+  // A native implementation of the rule. Values it passes skip evaluating expr.
+  std::shared_ptr<const NativeRule> native;
+  // The value bound to `rule`, if the rule has a rule field in a rules message.
+  absl::optional<google::api::expr::runtime::CelValue> ruleValue;
+  // Whether expr reads `now`. The clock is only read for rules that do.
+  bool usesNow = false;
+};
+
+// The compiled rule expressions of a rule set, and the rules message they read rule values from.
+struct CompiledRules {
+  google::api::expr::runtime::CelValue rules;
+  std::vector<CompiledRule> exprs;
+  // A private copy of the rules message, once the rule set has been interned, so that it does
+  // not refer to the options of the descriptor pool it was compiled from.
+  std::unique_ptr<google::protobuf::Message> ownedRules;
+  // The arena rule values are allocated on, which belongs to the compiled rules of one message
+  // type. Interned rule sets outlive the type that compiled them, so they allocate rule values on
+  // an arena of their own.
+  google::protobuf::Arena* arena = nullptr;
+  std::unique_ptr<google::protobuf::Arena> ownedArena;
 };
 
 // An abstract base class for rules that are compiled into CEL expressions.
@@ -40,33 +66,67 @@ class CelValidationRules : public ValidationRules {
   using Base::Base;
 
   absl::Status Add(
-      google::api::expr::runtime::CelExpressionBuilder& builder,
+      RuleCompiler& compiler,
       Rule rule,
       absl::optional<FieldPath> rulePath,
-      const google::protobuf::FieldDescriptor* ruleField);
+      const google::protobuf::FieldDescriptor* ruleField,
+      std::shared_ptr<const NativeRule> native = nullptr);
   absl::Status Add(
-      google::api::expr::runtime::CelExpressionBuilder& builder,
+      RuleCompiler& compiler,
       std::string_view id,
       std::string_view message,
       std::string_view expression,
       absl::optional<FieldPath> rulePath,
-      const google::protobuf::FieldDescriptor* ruleField);
+      const google::protobuf::FieldDescriptor* ruleField,
+      std::shared_ptr<const NativeRule> native = nullptr);
   absl::Status Add(
-      google::api::expr::runtime::CelExpressionBuilder& builder,
+      RuleCompiler& compiler,
       std::string_view expression,
       absl::optional<FieldPath> rulePath,
       const google::protobuf::FieldDescriptor* ruleField);
 
-  // Validate all the cel rules given the activation that already has 'this' bound.
+  // Validate all the cel rules given the activation that already has 'this' bound. If thisValue
+  // is given, it must be the value bound to 'this', and rules whose native implementation passes
+  // it are skipped.
   absl::Status ValidateCel(
-      RuleContext& ctx, google::api::expr::runtime::Activation& activation) const;
+      RuleContext& ctx,
+      google::api::expr::runtime::Activation& activation,
+      const google::api::expr::runtime::CelValue* thisValue = nullptr) const;
+
+  // Validate all the cel rules against thisValue. An activation is only created if some rule has
+  // no native implementation, or its native implementation does not pass thisValue.
+  absl::Status ValidateCel(RuleContext& ctx, google::api::expr::runtime::CelValue thisValue) const;
+
+  // Returns true if every rule has a native implementation.
+  [[nodiscard]] bool NativeOnly() const;
 
-  void setRules(google::api::expr::runtime::CelValue rules) { rules_ = rules; }
+  // Returns true if the native implementation of every rule passes value. Rules without one do
+  // not pass.
+  [[nodiscard]] bool PassesNative(const google::api::expr::runtime::CelValue& value) const;
+
+  // If the native implementation of every rule is a membership test on a set of integers,
+  // returns each set along with whether its membership is negated, and otherwise nullopt.
+  [[nodiscard]] absl::optional<std::vector<std::pair<const IntSet*, bool>>> NativeIntSets() const;
+
+  void setRules(google::api::expr::runtime::CelValue rules) { compiled_->rules = rules; }
   void setRules(const google::protobuf::Message* rules, google::protobuf::Arena* arena);
 
+  // Replaces the compiled rules with an identical set compiled earlier under the same key, if
+  // there is one, so that both share a single copy. Interned rule sets may be shared by
+  // factories over other descriptor pools, so rule sets that refer to a dynamic pool are left
+  // alone. No rules may be added afterwards.
+  void Intern(SharedCache<CompiledRules>& cache, std::string_view key);
+
  protected:
-  google::api::expr::runtime::CelValue rules_;
-  std::vector<CompiledRule> exprs_;
+  // Returns the memory used by the compiled rules, if they are not shared with other rules.
+  [[nodiscard]] size_t CompiledSpaceUsed() const;
+
+  std::shared_ptr<CompiledRules> compiled_ = std::make_shared<CompiledRules>();
+
+ private:
+  // Returns the value to bind to `rule` for ruleField, allocated on the rule set's arena.
+  [[nodiscard]] absl::optional<google::api::expr::runtime::CelValue> ruleValue(
+      const google::protobuf::FieldDescriptor* ruleField) const;
 };
 
 } // namespace buf::validate::internal
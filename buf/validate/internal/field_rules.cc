@@ -14,6 +14,7 @@
 
 #include "buf/validate/internal/field_rules.h"
 
+#include "absl/strings/str_cat.h"
 #include "buf/validate/internal/cel_rules.h"
 #include "google/protobuf/any.pb.h"
 
@@ -22,7 +23,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
     std::unique_ptr<MessageFactory>& messageFactory,
     bool allowUnknownFields,
     google::protobuf::Arena* arena,
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     const google::protobuf::FieldDescriptor* field,
     const FieldRules& fieldLvl) {
   if (fieldLvl.ignore() == IGNORE_ALWAYS) {
@@ -35,7 +36,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.bool_(),
@@ -47,7 +48,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.float_(),
@@ -59,7 +60,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.double_(),
@@ -71,7 +72,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.int32(),
@@ -83,7 +84,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.int64(),
@@ -95,7 +96,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.uint32(),
@@ -107,7 +108,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.uint64(),
@@ -119,7 +120,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.sint32(),
@@ -130,7 +131,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.sint64(),
@@ -141,7 +142,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.fixed32(),
@@ -152,7 +153,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.fixed64(),
@@ -163,7 +164,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.sfixed32(),
@@ -174,7 +175,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.sfixed64(),
@@ -185,7 +186,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.string(),
@@ -197,7 +198,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.bytes(),
@@ -211,7 +212,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
           messageFactory,
           allowUnknownFields,
           arena,
-          builder,
+          compiler,
           field,
           fieldLvl,
           fieldLvl.enum_(),
@@ -229,7 +230,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
       } else {
         auto result = std::make_unique<FieldValidationRules>(field, fieldLvl);
         auto status = BuildCelRules(
-            messageFactory, allowUnknownFields, arena, builder, fieldLvl.duration(), *result);
+            messageFactory, allowUnknownFields, arena, compiler, fieldLvl.duration(), *result);
         if (!status.ok()) {
           rules_or = status;
         } else {
@@ -245,7 +246,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
       } else {
         auto result = std::make_unique<FieldValidationRules>(field, fieldLvl);
         auto status = BuildCelRules(
-            messageFactory, allowUnknownFields, arena, builder, fieldLvl.field_mask(), *result);
+            messageFactory, allowUnknownFields, arena, compiler, fieldLvl.field_mask(), *result);
         if (!status.ok()) {
           rules_or = status;
         } else {
@@ -261,7 +262,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
       } else {
         auto result = std::make_unique<FieldValidationRules>(field, fieldLvl);
         auto status = BuildCelRules(
-            messageFactory, allowUnknownFields, arena, builder, fieldLvl.timestamp(), *result);
+            messageFactory, allowUnknownFields, arena, compiler, fieldLvl.timestamp(), *result);
         if (!status.ok()) {
           rules_or = status;
         } else {
@@ -281,7 +282,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
               messageFactory,
               allowUnknownFields,
               arena,
-              builder,
+              compiler,
               field,
               fieldLvl.repeated().items());
           if (!items_or.ok()) {
@@ -291,7 +292,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
         }
         auto result = std::make_unique<RepeatedValidationRules>(field, fieldLvl, std::move(items));
         auto status = BuildCelRules(
-            messageFactory, allowUnknownFields, arena, builder, fieldLvl.repeated(), *result);
+            messageFactory, allowUnknownFields, arena, compiler, fieldLvl.repeated(), *result);
         if (!status.ok()) {
           rules_or = status;
         } else {
@@ -307,7 +308,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
             messageFactory,
             allowUnknownFields,
             arena,
-            builder,
+            compiler,
             field->message_type()->field(0),
             fieldLvl.map().keys());
         if (!keyRulesOr.ok()) {
@@ -317,7 +318,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
             messageFactory,
             allowUnknownFields,
             arena,
-            builder,
+            compiler,
             field->message_type()->field(1),
             fieldLvl.map().values());
         if (!valueRulesOr.ok()) {
@@ -326,7 +327,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
         auto result = std::make_unique<MapValidationRules>(
             field, fieldLvl, std::move(keyRulesOr).value(), std::move(valueRulesOr).value());
         auto status = BuildCelRules(
-            messageFactory, allowUnknownFields, arena, builder, fieldLvl.map(), *result);
+            messageFactory, allowUnknownFields, arena, compiler, fieldLvl.map(), *result);
         if (!status.ok()) {
           rules_or = status;
         } else {
@@ -341,7 +342,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
       } else {
         auto result = std::make_unique<FieldValidationRules>(field, fieldLvl, &fieldLvl.any());
         auto status = BuildCelRules(
-            messageFactory, allowUnknownFields, arena, builder, fieldLvl.any(), *result);
+            messageFactory, allowUnknownFields, arena, compiler, fieldLvl.any(), *result);
         if (!status.ok()) {
           rules_or = status;
         } else {
@@ -364,7 +365,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
       celElement.set_index(i);
       FieldPath rulePath;
       *rulePath.mutable_elements()->Add() = celElement;
-      auto status = rules_or.value()->Add(builder, expr, rulePath, nullptr);
+      auto status = rules_or.value()->Add(compiler, expr, rulePath, nullptr);
       if (!status.ok()) {
         return status;
       }
@@ -376,11 +377,17 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
       celElement.set_index(i);
       FieldPath rulePath;
       *rulePath.mutable_elements()->Add() = celElement;
-      auto status = rules_or.value()->Add(builder, rule, rulePath, nullptr);
+      auto status = rules_or.value()->Add(compiler, rule, rulePath, nullptr);
       if (!status.ok()) {
         return status;
       }
     }
+    // Fields with identical rules compile to identical expressions, so share them.
+    if (compiler.caches() != nullptr) {
+      rules_or.value()->Intern(
+          compiler.caches()->ruleSets,
+          absl::StrCat(static_cast<int>(field->type()), ":", fieldLvl.SerializeAsString()));
+    }
   }
   return rules_or;
 }
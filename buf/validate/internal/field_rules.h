@@ -28,7 +28,7 @@ absl::Status BuildScalarFieldRules(
     std::unique_ptr<MessageFactory>& messageFactory,
     bool allowUnknownFields,
     google::protobuf::Arena* arena,
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     const google::protobuf::FieldDescriptor* field,
     const FieldRules& fieldLvl,
     const R& rules,
@@ -49,7 +49,7 @@ absl::Status BuildScalarFieldRules(
           google::protobuf::FieldDescriptor::TypeName(expectedType)));
     }
   }
-  return BuildCelRules(messageFactory, allowUnknownFields, arena, builder, rules, result);
+  return BuildCelRules(messageFactory, allowUnknownFields, arena, compiler, rules, result);
 }
 
 template <typename R>
@@ -57,7 +57,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewScalarFieldRules(
     std::unique_ptr<MessageFactory>& messageFactory,
     bool allowUnknownFields,
     google::protobuf::Arena* arena,
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     const google::protobuf::FieldDescriptor* field,
     const FieldRules& fieldLvl,
     const R& rules,
@@ -69,7 +69,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewScalarFieldRules(
       messageFactory,
       allowUnknownFields,
       arena,
-      builder,
+      compiler,
       field,
       fieldLvl,
       rules,
@@ -85,7 +85,7 @@ absl::StatusOr<std::unique_ptr<FieldValidationRules>> NewFieldRules(
     std::unique_ptr<MessageFactory>& messageFactory,
     bool allowUnknownFields,
     google::protobuf::Arena* arena,
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     const google::protobuf::FieldDescriptor* field,
     const FieldRules& fieldLvl);
 
@@ -22,15 +22,15 @@
 namespace buf::validate::internal {
 
 absl::StatusOr<std::unique_ptr<MessageValidationRules>> BuildMessageRules(
-    google::api::expr::runtime::CelExpressionBuilder& builder, const MessageRules& rules) {
+    RuleCompiler& compiler, const MessageRules& rules) {
   auto result = std::make_unique<MessageValidationRules>();
   for (const auto& expr: rules.cel_expression()) {
-    if (auto status = result->Add(builder, expr, absl::nullopt, nullptr); !status.ok()) {
+    if (auto status = result->Add(compiler, expr, absl::nullopt, nullptr); !status.ok()) {
       return status;
     }
   }
   for (const auto& rule : rules.cel()) {
-    if (auto status = result->Add(builder, rule, absl::nullopt, nullptr); !status.ok()) {
+    if (auto status = result->Add(compiler, rule, absl::nullopt, nullptr); !status.ok()) {
       return status;
     }
   }
@@ -41,13 +41,13 @@ Rules NewMessageRules(
     std::unique_ptr<MessageFactory>& messageFactory,
     bool allowUnknownFields,
     google::protobuf::Arena* arena,
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     const google::protobuf::Descriptor* descriptor) {
   std::vector<std::unique_ptr<ValidationRules>> result;
   std::unordered_set<std::string> allMsgOneofs;
   if (descriptor->options().HasExtension(buf::validate::message)) {
     const auto& msgLvl = descriptor->options().GetExtension(buf::validate::message);
-    auto rules_or = BuildMessageRules(builder, msgLvl);
+    auto rules_or = BuildMessageRules(compiler, msgLvl);
     if (!rules_or.ok()) {
       return rules_or.status();
     }
@@ -90,7 +90,7 @@ Rules NewMessageRules(
       fieldLvl = *fieldLvlOvr;
     }
     auto rules_or =
-        NewFieldRules(messageFactory, allowUnknownFields, arena, builder, field, fieldLvl);
+        NewFieldRules(messageFactory, allowUnknownFields, arena, compiler, field, fieldLvl);
     if (!rules_or.ok()) {
       return rules_or.status();
     }
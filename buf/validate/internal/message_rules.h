@@ -30,10 +30,10 @@ Rules NewMessageRules(
     std::unique_ptr<MessageFactory>& messageFactory,
     bool allowUnknownFields,
     google::protobuf::Arena* arena,
-    google::api::expr::runtime::CelExpressionBuilder& builder,
+    RuleCompiler& compiler,
     const google::protobuf::Descriptor* descriptor);
 
 absl::StatusOr<std::unique_ptr<MessageValidationRules>> BuildMessageRules(
-    google::api::expr::runtime::CelExpressionBuilder& builder, const MessageRules& rules);
+    RuleCompiler& compiler, const MessageRules& rules);
 
 } // namespace buf::validate::internal
\ No newline at end of file
@@ -0,0 +1,1179 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/native_rules.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "buf/validate/internal/proto_field.h"
+
+namespace buf::validate::internal {
+namespace cel = google::api::expr;
+namespace {
+
+template <typename T>
+bool getNumber(const cel::runtime::CelValue& value, T& out) {
+  if constexpr (std::is_same_v<T, int64_t>) {
+    if (value.IsInt64()) {
+      out = value.Int64OrDie();
+      return true;
+    }
+  } else if constexpr (std::is_same_v<T, uint64_t>) {
+    if (value.IsUint64()) {
+      out = value.Uint64OrDie();
+      return true;
+    }
+  } else if constexpr (std::is_same_v<T, absl::Duration>) {
+    if (value.IsDuration()) {
+      out = value.DurationOrDie();
+      return true;
+    }
+  } else if constexpr (std::is_same_v<T, absl::Time>) {
+    if (value.IsTimestamp()) {
+      out = value.TimestampOrDie();
+      return true;
+    }
+  } else {
+    if (value.IsDouble()) {
+      out = value.DoubleOrDie();
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if time is within the range of timestamps CEL supports. Arithmetic whose result
+// falls outside of it fails with an overflow error.
+bool isValidTimestamp(absl::Time time) {
+  static constexpr int64_t kMinSeconds = -62135596800; // 0001-01-01T00:00:00Z
+  static constexpr int64_t kMaxSeconds = 253402300799; // 9999-12-31T23:59:59Z
+  return time >= absl::FromUnixSeconds(kMinSeconds) &&
+      time < absl::FromUnixSeconds(kMaxSeconds + 1);
+}
+
+// Returns true if duration is within the range of durations CEL supports.
+bool isValidDuration(absl::Duration duration) {
+  static constexpr int64_t kMaxSeconds = 315576000000; // About 10000 years.
+  return absl::AbsDuration(duration) < absl::Seconds(kMaxSeconds + 1);
+}
+
+// Returns true if value compares like any other: it is not NaN, and timestamps and durations are
+// within the range CEL supports, beyond which CEL reports errors instead.
+template <typename T>
+bool isOrdinary(T value) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return !std::isnan(value);
+  } else if constexpr (std::is_same_v<T, absl::Duration>) {
+    return isValidDuration(value);
+  } else if constexpr (std::is_same_v<T, absl::Time>) {
+    return isValidTimestamp(value);
+  } else {
+    return true;
+  }
+}
+
+// Converts a google.protobuf.Duration or google.protobuf.Timestamp message to the representation
+// CEL uses, which is T.
+template <typename T>
+absl::optional<T> toTime(const google::protobuf::Message& message) {
+  const auto* descriptor = message.GetDescriptor();
+  const auto* seconds = descriptor->FindFieldByName("seconds");
+  const auto* nanos = descriptor->FindFieldByName("nanos");
+  constexpr std::string_view type = std::is_same_v<T, absl::Duration>
+      ? "google.protobuf.Duration"
+      : "google.protobuf.Timestamp";
+  if (descriptor->full_name() != type || seconds == nullptr || nanos == nullptr) {
+    return absl::nullopt;
+  }
+  const auto* reflection = message.GetReflection();
+  auto duration = absl::Seconds(reflection->GetInt64(message, seconds)) +
+      absl::Nanoseconds(reflection->GetInt32(message, nanos));
+  if constexpr (std::is_same_v<T, absl::Duration>) {
+    return duration;
+  } else {
+    return absl::UnixEpoch() + duration;
+  }
+}
+
+// Returns the value of the named field of rules, if it is set and holds a T.
+template <typename T>
+absl::optional<T> getRule(const google::protobuf::Message& rules, std::string_view name) {
+  const auto* field = rules.GetDescriptor()->FindFieldByName(std::string(name));
+  if (field == nullptr) {
+    return absl::nullopt;
+  }
+  auto value = ProtoField(&rules, field).variant();
+  if constexpr (std::is_same_v<T, absl::Duration> || std::is_same_v<T, absl::Time>) {
+    if (const auto* message = absl::get_if<const google::protobuf::Message*>(&value)) {
+      return toTime<T>(**message);
+    }
+  } else if (const auto* number = absl::get_if<T>(&value)) {
+    return *number;
+  }
+  return absl::nullopt;
+}
+
+// The gt, gte, lt and lte rules. Passes values that satisfy every bound that is set. Exclusive
+// ranges, where the upper bound is below the lower bound, pass no values, so they always fall
+// back to CEL.
+template <typename T>
+class RangeRule final : public NativeRule {
+ public:
+  RangeRule(
+      absl::optional<T> lower, bool lowerInclusive, absl::optional<T> upper, bool upperInclusive)
+      : lower_(lower),
+        upper_(upper),
+        lowerInclusive_(lowerInclusive),
+        upperInclusive_(upperInclusive) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    T number;
+    if (!getNumber(value, number) || !isOrdinary(number)) {
+      return false;
+    }
+    if (lower_.has_value() && (lowerInclusive_ ? number < *lower_ : number <= *lower_)) {
+      return false;
+    }
+    if (upper_.has_value() && (upperInclusive_ ? number > *upper_ : number >= *upper_)) {
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  absl::optional<T> lower_;
+  absl::optional<T> upper_;
+  bool lowerInclusive_;
+  bool upperInclusive_;
+};
+
+template <typename T>
+class ConstRule final : public NativeRule {
+ public:
+  explicit ConstRule(T value) : value_(value) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    T number;
+    return getNumber(value, number) && number == value_;
+  }
+
+ private:
+  T value_;
+};
+
+class FiniteRule final : public NativeRule {
+ public:
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    return value.IsDouble() && std::isfinite(value.DoubleOrDie());
+  }
+};
+
+// Returns the number of code points in text, or nullopt if it is not valid UTF-8.
+absl::optional<uint64_t> countCodePoints(std::string_view text) {
+  uint64_t count = 0;
+  size_t i = 0;
+  while (i < text.size()) {
+    auto lead = static_cast<unsigned char>(text[i]);
+    size_t length;
+    uint32_t codePoint;
+    if (lead < 0x80) {
+      i++;
+      count++;
+      continue;
+    } else if ((lead & 0xE0) == 0xC0) {
+      length = 2;
+      codePoint = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+      length = 3;
+      codePoint = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+      length = 4;
+      codePoint = lead & 0x07;
+    } else {
+      return absl::nullopt;
+    }
+    if (text.size() - i < length) {
+      return absl::nullopt;
+    }
+    for (size_t j = 1; j < length; j++) {
+      auto next = static_cast<unsigned char>(text[i + j]);
+      if ((next & 0xC0) != 0x80) {
+        return absl::nullopt;
+      }
+      codePoint = (codePoint << 6) | (next & 0x3F);
+    }
+    // Reject overlong encodings, surrogates and values past the last code point.
+    static constexpr uint32_t kMinCodePoint[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (codePoint < kMinCodePoint[length] || codePoint > 0x10FFFF ||
+        (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+      return absl::nullopt;
+    }
+    i += length;
+    count++;
+  }
+  return count;
+}
+
+// Returns the contents of a string value, or a bytes value if bytes is set.
+bool getText(const cel::runtime::CelValue& value, bool bytes, std::string_view& out) {
+  if (bytes) {
+    if (value.IsBytes()) {
+      out = value.BytesOrDie().value();
+      return true;
+    }
+  } else if (value.IsString()) {
+    out = value.StringOrDie().value();
+    return true;
+  }
+  return false;
+}
+
+enum class LengthUnit { kBytes, kCodePoints };
+
+// The len, min_len, max_len, len_bytes, min_bytes and max_bytes rules.
+class LengthRule final : public NativeRule {
+ public:
+  LengthRule(bool bytes, LengthUnit unit, uint64_t min, uint64_t max)
+      : bytes_(bytes), unit_(unit), min_(min), max_(max) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    std::string_view text;
+    if (!getText(value, bytes_, text)) {
+      return false;
+    }
+    uint64_t length = text.size();
+    if (unit_ == LengthUnit::kCodePoints) {
+      // A code point takes one to four bytes, which often decides the rule without counting.
+      if ((length + 3) / 4 >= min_ && length <= max_) {
+        return true;
+      }
+      auto count = countCodePoints(text);
+      if (!count.has_value()) {
+        return false;
+      }
+      length = *count;
+    }
+    return length >= min_ && length <= max_;
+  }
+
+ private:
+  bool bytes_;
+  LengthUnit unit_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+enum class TextOp { kEquals, kPrefix, kSuffix, kContains, kNotContains };
+
+// The const, prefix, suffix, contains and not_contains rules.
+class TextRule final : public NativeRule {
+ public:
+  TextRule(bool bytes, TextOp op, std::string operand)
+      : bytes_(bytes), op_(op), operand_(std::move(operand)) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    std::string_view text;
+    if (!getText(value, bytes_, text)) {
+      return false;
+    }
+    switch (op_) {
+      case TextOp::kEquals:
+        return text == operand_;
+      case TextOp::kPrefix:
+        return absl::StartsWith(text, operand_);
+      case TextOp::kSuffix:
+        return absl::EndsWith(text, operand_);
+      case TextOp::kContains:
+        return absl::StrContains(text, operand_);
+      case TextOp::kNotContains:
+        return !absl::StrContains(text, operand_);
+    }
+    return false;
+  }
+
+ private:
+  bool bytes_;
+  TextOp op_;
+  std::string operand_;
+};
+
+std::shared_ptr<const NativeRule> newTextRule(
+    const google::protobuf::Message& rules, std::string_view name, bool bytes) {
+  static const auto* const kLengthRules =
+      new absl::flat_hash_map<std::string_view, std::pair<bool, bool>>{
+          // name -> (has lower bound, has upper bound)
+          {"len", {true, true}},
+          {"min_len", {true, false}},
+          {"max_len", {false, true}},
+          {"len_bytes", {true, true}},
+          {"min_bytes", {true, false}},
+          {"max_bytes", {false, true}},
+      };
+  static const auto* const kTextOps = new absl::flat_hash_map<std::string_view, TextOp>{
+      {"const", TextOp::kEquals},
+      {"prefix", TextOp::kPrefix},
+      {"suffix", TextOp::kSuffix},
+      {"contains", TextOp::kContains},
+      {"not_contains", TextOp::kNotContains},
+  };
+  if (auto iter = kLengthRules->find(name); iter != kLengthRules->end()) {
+    auto length = getRule<uint64_t>(rules, name);
+    if (!length.has_value()) {
+      return nullptr;
+    }
+    // String lengths are measured in code points, except by the *_bytes rules.
+    LengthUnit unit = bytes || absl::EndsWith(name, "_bytes") ? LengthUnit::kBytes
+                                                               : LengthUnit::kCodePoints;
+    return std::make_shared<LengthRule>(
+        bytes,
+        unit,
+        iter->second.first ? *length : 0,
+        iter->second.second ? *length : std::numeric_limits<uint64_t>::max());
+  }
+  if (auto iter = kTextOps->find(name); iter != kTextOps->end()) {
+    auto operand = getRule<std::string>(rules, name);
+    if (!operand.has_value()) {
+      return nullptr;
+    }
+    return std::make_shared<TextRule>(bytes, iter->second, std::move(*operand));
+  }
+  return nullptr;
+}
+
+// The literals that every match of a regular expression must contain.
+struct PatternLiterals {
+  // Runs of literal characters that every match contains.
+  std::vector<std::string> required;
+  // Whether the pattern starts with `^` or ends with `$`.
+  bool anchoredStart = false;
+  bool anchoredEnd = false;
+  // Whether the pattern starts with `^` followed by the first required literal.
+  bool prefix = false;
+  // Whether the pattern ends with the last required literal followed by `$`.
+  bool suffix = false;
+  // Whether the pattern is nothing but literal characters and anchors, in which case required
+  // holds at most one literal.
+  bool literalOnly = false;
+};
+
+// Skips a character class starting at pattern[i], returning the index just past it, or
+// std::string_view::npos if the class is not terminated.
+size_t skipClass(std::string_view pattern, size_t i) {
+  i++;
+  if (i < pattern.size() && pattern[i] == '^') {
+    i++;
+  }
+  if (i < pattern.size() && pattern[i] == ']') {
+    i++;
+  }
+  while (i < pattern.size()) {
+    if (pattern[i] == '\\') {
+      i += 2;
+    } else if (pattern.substr(i, 2) == "[:") {
+      auto end = pattern.find(":]", i + 2);
+      if (end == std::string_view::npos) {
+        return end;
+      }
+      i = end + 2;
+    } else if (pattern[i] == ']') {
+      return i + 1;
+    } else {
+      i++;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Skips a group starting at pattern[i], returning the index just past it, or
+// std::string_view::npos if the group is not terminated.
+size_t skipGroup(std::string_view pattern, size_t i) {
+  int depth = 0;
+  while (i < pattern.size()) {
+    switch (pattern[i]) {
+      case '\\':
+        i += 2;
+        continue;
+      case '[':
+        i = skipClass(pattern, i);
+        if (i == std::string_view::npos) {
+          return i;
+        }
+        continue;
+      case '(':
+        depth++;
+        break;
+      case ')':
+        if (--depth == 0) {
+          return i + 1;
+        }
+        break;
+      default:
+        break;
+    }
+    i++;
+  }
+  return std::string_view::npos;
+}
+
+// Returns the length of a counted repetition like `{2}` or `{2,5}` at pattern[i], or 0 if there
+// is none, in which case RE2 treats the brace as a literal.
+size_t repetitionLength(std::string_view pattern, size_t i) {
+  size_t j = i + 1;
+  auto digits = [&]() {
+    size_t start = j;
+    while (j < pattern.size() && absl::ascii_isdigit(static_cast<unsigned char>(pattern[j]))) {
+      j++;
+    }
+    return j > start;
+  };
+  if (!digits()) {
+    return 0;
+  }
+  if (j < pattern.size() && pattern[j] == ',') {
+    j++;
+    digits();
+  }
+  if (j < pattern.size() && pattern[j] == '}') {
+    return j + 1 - i;
+  }
+  return 0;
+}
+
+// Extracts the required literals of an RE2 pattern. Only a conservative subset of the syntax is
+// understood; returns nullopt for anything else, such as top-level alternations, flags, non-ASCII
+// characters and escapes that take arguments.
+absl::optional<PatternLiterals> analyzePattern(std::string_view pattern) {
+  enum class Kind { kLiteral, kOther, kStart, kEnd };
+  struct Token {
+    Kind kind;
+    char literal;
+  };
+  std::vector<Token> tokens;
+  bool repeated = false;
+  size_t i = 0;
+  while (i < pattern.size()) {
+    auto c = static_cast<unsigned char>(pattern[i]);
+    if (c >= 0x80 || c == '|') {
+      return absl::nullopt;
+    }
+    size_t repetition = c == '{' ? repetitionLength(pattern, i) : 0;
+    if (c == '*' || c == '+' || c == '?' || repetition > 0) {
+      // The repeated token is no longer a required literal.
+      if (repeated || tokens.empty() || tokens.back().kind == Kind::kStart) {
+        return absl::nullopt;
+      }
+      tokens.back().kind = Kind::kOther;
+      i += repetition > 0 ? repetition : 1;
+      if (i < pattern.size() && pattern[i] == '?') {
+        i++;
+      }
+      repeated = true;
+      continue;
+    }
+    repeated = false;
+    switch (c) {
+      case '^':
+        tokens.push_back({i == 0 ? Kind::kStart : Kind::kOther, 0});
+        i++;
+        break;
+      case '$':
+        tokens.push_back({i == pattern.size() - 1 ? Kind::kEnd : Kind::kOther, 0});
+        i++;
+        break;
+      case '.':
+        tokens.push_back({Kind::kOther, 0});
+        i++;
+        break;
+      case '\\': {
+        if (i + 1 >= pattern.size()) {
+          return absl::nullopt;
+        }
+        auto escaped = static_cast<unsigned char>(pattern[i + 1]);
+        if (escaped >= 0x80) {
+          return absl::nullopt;
+        }
+        if (absl::ascii_isalnum(escaped)) {
+          // Only single character classes and assertions; others, like \x41 or \pL, take
+          // arguments.
+          if (!absl::StrContains("dDwWsSbBAz", static_cast<char>(escaped))) {
+            return absl::nullopt;
+          }
+          tokens.push_back({Kind::kOther, 0});
+        } else {
+          tokens.push_back({Kind::kLiteral, static_cast<char>(escaped)});
+        }
+        i += 2;
+        break;
+      }
+      case '[':
+        i = skipClass(pattern, i);
+        if (i == std::string_view::npos) {
+          return absl::nullopt;
+        }
+        tokens.push_back({Kind::kOther, 0});
+        break;
+      case '(': {
+        if (pattern.substr(i, 2) == "(?") {
+          // Flag groups like (?i) change the meaning of the rest of the pattern.
+          size_t j = i + 2;
+          while (j < pattern.size() && (absl::ascii_isalpha(pattern[j]) || pattern[j] == '-')) {
+            j++;
+          }
+          if (j < pattern.size() && pattern[j] == ')') {
+            return absl::nullopt;
+          }
+        }
+        i = skipGroup(pattern, i);
+        if (i == std::string_view::npos) {
+          return absl::nullopt;
+        }
+        tokens.push_back({Kind::kOther, 0});
+        break;
+      }
+      case ')':
+        return absl::nullopt;
+      default:
+        tokens.push_back({Kind::kLiteral, static_cast<char>(c)});
+        i++;
+        break;
+    }
+  }
+
+  PatternLiterals result;
+  result.literalOnly = true;
+  std::string run;
+  for (const auto& token : tokens) {
+    if (token.kind == Kind::kLiteral) {
+      run.push_back(token.literal);
+      continue;
+    }
+    if (token.kind == Kind::kOther) {
+      result.literalOnly = false;
+    }
+    if (!run.empty()) {
+      result.required.push_back(std::move(run));
+      run.clear();
+    }
+  }
+  if (!run.empty()) {
+    result.required.push_back(std::move(run));
+  }
+  result.anchoredStart = !tokens.empty() && tokens.front().kind == Kind::kStart;
+  result.anchoredEnd = !tokens.empty() && tokens.back().kind == Kind::kEnd;
+  result.prefix = result.anchoredStart && tokens.size() >= 2 && tokens[1].kind == Kind::kLiteral;
+  result.suffix = result.anchoredEnd && tokens.size() >= 2 &&
+      tokens[tokens.size() - 2].kind == Kind::kLiteral;
+  return result;
+}
+
+// The pattern rule. Inputs that lack a literal every match requires are rejected without running
+// the regular expression, and patterns made only of literals and anchors are decided without it.
+class PatternRule final : public NativeRule {
+ public:
+  explicit PatternRule(PatternLiterals literals) : literals_(std::move(literals)) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    std::string_view text;
+    return literals_.literalOnly && getText(value, /*bytes=*/false, text) && matchesLiteral(text);
+  }
+
+  [[nodiscard]] bool Fails(const cel::runtime::CelValue& value) const override {
+    std::string_view text;
+    // The witness is the empty string, which only fails if a non-empty literal is required.
+    if (literals_.required.empty() || !getText(value, /*bytes=*/false, text)) {
+      return false;
+    }
+    if (literals_.literalOnly) {
+      return !matchesLiteral(text);
+    }
+    if (literals_.prefix && !absl::StartsWith(text, literals_.required.front())) {
+      return true;
+    }
+    if (literals_.suffix && !absl::EndsWith(text, literals_.required.back())) {
+      return true;
+    }
+    for (const auto& literal : literals_.required) {
+      if (!absl::StrContains(text, literal)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  [[nodiscard]] cel::runtime::CelValue Witness() const override {
+    return cel::runtime::CelValue::CreateStringView("");
+  }
+
+ private:
+  [[nodiscard]] bool matchesLiteral(std::string_view text) const {
+    std::string_view literal = literals_.required.empty() ? "" : literals_.required.front();
+    if (literals_.anchoredStart && literals_.anchoredEnd) {
+      return text == literal;
+    }
+    if (literals_.anchoredStart) {
+      return absl::StartsWith(text, literal);
+    }
+    if (literals_.anchoredEnd) {
+      return absl::EndsWith(text, literal);
+    }
+    return absl::StrContains(text, literal);
+  }
+
+  PatternLiterals literals_;
+};
+
+std::shared_ptr<const NativeRule> newPatternRule(const google::protobuf::Message& rules) {
+  auto pattern = getRule<std::string>(rules, "pattern");
+  if (!pattern.has_value()) {
+    return nullptr;
+  }
+  auto literals = analyzePattern(*pattern);
+  if (!literals.has_value() || (literals->required.empty() && !literals->literalOnly)) {
+    return nullptr;
+  }
+  return std::make_shared<PatternRule>(*std::move(literals));
+}
+
+template <typename T>
+std::shared_ptr<const NativeRule> newNumericRule(
+    const google::protobuf::Message& rules, std::string_view name) {
+  if (name == "const") {
+    auto value = getRule<T>(rules, "const");
+    if (!value.has_value() || !isOrdinary(*value)) {
+      return nullptr;
+    }
+    return std::make_shared<ConstRule<T>>(*value);
+  }
+  if (name == "gt" || name == "gte" || name == "lt" || name == "lte") {
+    auto gt = getRule<T>(rules, "gt");
+    auto gte = getRule<T>(rules, "gte");
+    auto lt = getRule<T>(rules, "lt");
+    auto lte = getRule<T>(rules, "lte");
+    auto lower = gt.has_value() ? gt : gte;
+    auto upper = lt.has_value() ? lt : lte;
+    if ((lower.has_value() && !isOrdinary(*lower)) ||
+        (upper.has_value() && !isOrdinary(*upper))) {
+      return nullptr;
+    }
+    return std::make_shared<RangeRule<T>>(lower, !gt.has_value(), upper, !lt.has_value());
+  }
+  if (name == "finite") {
+    auto finite = ProtoField(&rules, rules.GetDescriptor()->FindFieldByName("finite")).variant();
+    if (const auto* enabled = absl::get_if<bool>(&finite); enabled != nullptr && *enabled) {
+      return std::make_shared<FiniteRule>();
+    }
+  }
+  return nullptr;
+}
+
+// The lt_now, gt_now and within rules of timestamps. Passes values strictly between now minus
+// before and now plus after, where either bound may be absent. Values on a bound, and bounds
+// outside of the range CEL supports, where its arithmetic fails with an overflow error, are left
+// to CEL.
+class NowRule final : public NativeRule {
+ public:
+  NowRule(absl::optional<absl::Duration> before, absl::optional<absl::Duration> after)
+      : before_(before), after_(after) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& /*value*/) const override {
+    return false;
+  }
+
+  [[nodiscard]] bool UsesNow() const override { return true; }
+
+  [[nodiscard]] bool PassesAt(const cel::runtime::CelValue& value, absl::Time now) const override {
+    absl::Time time;
+    if (!getNumber(value, time) || !isValidTimestamp(time)) {
+      return false;
+    }
+    if (before_.has_value()) {
+      absl::Time lower = now - *before_;
+      if (!isValidTimestamp(lower) || time <= lower) {
+        return false;
+      }
+    }
+    if (after_.has_value()) {
+      absl::Time upper = now + *after_;
+      if (!isValidTimestamp(upper) || time >= upper) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  absl::optional<absl::Duration> before_;
+  absl::optional<absl::Duration> after_;
+};
+
+std::shared_ptr<const NativeRule> newTimestampRule(
+    const google::protobuf::Message& rules, std::string_view name) {
+  if (name == "lt_now" || name == "gt_now") {
+    auto enabled = getRule<bool>(rules, name);
+    if (!enabled.has_value()) {
+      return nullptr;
+    }
+    if (!*enabled) {
+      // The rule is disabled, so every timestamp passes.
+      return std::make_shared<NowRule>(absl::nullopt, absl::nullopt);
+    }
+    if (name == "lt_now") {
+      return std::make_shared<NowRule>(absl::nullopt, absl::ZeroDuration());
+    }
+    return std::make_shared<NowRule>(absl::ZeroDuration(), absl::nullopt);
+  }
+  if (name == "within") {
+    auto within = getRule<absl::Duration>(rules, "within");
+    if (!within.has_value() || !isValidDuration(*within)) {
+      return nullptr;
+    }
+    return std::make_shared<NowRule>(*within, *within);
+  }
+  return newNumericRule<absl::Time>(rules, name);
+}
+
+// Sets with at most this many values are scanned linearly, which beats hashing for short lists.
+constexpr size_t kLinearScanLimit = 8;
+
+// Returns true if sorted, which must be in ascending order, contains value. The search runs a
+// fixed number of steps for a given size, with a conditional move instead of a branch per step.
+template <typename T>
+bool sortedContains(const std::vector<T>& sorted, T value) {
+  if (sorted.empty()) {
+    return false;
+  }
+  const T* base = sorted.data();
+  size_t size = sorted.size();
+  while (size > 1) {
+    size_t half = size / 2;
+    base = base[half] < value ? base + half : base;
+    size -= half;
+  }
+  base += *base < value;
+  return base != sorted.data() + sorted.size() && *base == value;
+}
+
+// An immutable set of rule values, stored as a short list, a hash set, or a sorted array for
+// floating point values, whose hashes would not respect that -0.0 equals 0.0.
+template <typename T>
+class ValueSet {
+ public:
+  explicit ValueSet(std::vector<T> values) {
+    if constexpr (std::is_floating_point_v<T>) {
+      // NaN is not equal to anything, including NaN, so it never matches.
+      values.erase(
+          std::remove_if(values.begin(), values.end(), [](T v) { return std::isnan(v); }),
+          values.end());
+      std::sort(values.begin(), values.end());
+      list_ = std::move(values);
+    } else if (values.size() <= kLinearScanLimit) {
+      list_ = std::move(values);
+    } else {
+      set_.insert(values.begin(), values.end());
+    }
+  }
+
+  template <typename K>
+  [[nodiscard]] bool contains(const K& value) const {
+    if constexpr (std::is_floating_point_v<T>) {
+      return sortedContains(list_, value);
+    } else {
+      if (!set_.empty()) {
+        return set_.contains(value);
+      }
+      return std::find(list_.begin(), list_.end(), value) != list_.end();
+    }
+  }
+
+ private:
+  std::vector<T> list_;
+  absl::flat_hash_set<T> set_;
+};
+
+enum class ValueKind { kInt, kUint, kDouble, kString, kBytes, kDuration };
+
+// The in and not_in rules.
+template <typename T>
+class MembershipRule final : public NativeRule {
+ public:
+  MembershipRule(ValueKind kind, ValueSet<T> values, bool negated)
+      : kind_(kind), values_(std::move(values)), negated_(negated) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    if constexpr (std::is_same_v<T, std::string>) {
+      std::string_view text;
+      return getText(value, kind_ == ValueKind::kBytes, text) && values_.contains(text) != negated_;
+    } else if constexpr (std::is_same_v<T, absl::Duration>) {
+      return value.IsDuration() && values_.contains(value.DurationOrDie()) != negated_;
+    } else {
+      T number;
+      return getNumber(value, number) && values_.contains(number) != negated_;
+    }
+  }
+
+ private:
+  ValueKind kind_;
+  ValueSet<T> values_;
+  bool negated_;
+};
+
+template <typename T>
+std::shared_ptr<const NativeRule> newMembershipRule(
+    const google::protobuf::Message& rules,
+    const google::protobuf::FieldDescriptor* ruleField,
+    ValueKind kind) {
+  std::vector<T> values;
+  ProtoField field(&rules, ruleField);
+  for (int i = 0; i < field.size(); i++) {
+    auto item = field.at(i)->variant();
+    if constexpr (std::is_same_v<T, absl::Duration>) {
+      const auto* message = absl::get_if<const google::protobuf::Message*>(&item);
+      auto duration = message == nullptr ? absl::nullopt : toTime<absl::Duration>(**message);
+      if (!duration.has_value()) {
+        return nullptr;
+      }
+      values.push_back(*duration);
+    } else {
+      const auto* value = absl::get_if<T>(&item);
+      if (value == nullptr) {
+        return nullptr;
+      }
+      values.push_back(*value);
+    }
+  }
+  return std::make_shared<MembershipRule<T>>(
+      kind, ValueSet<T>(std::move(values)), ruleField->name() == "not_in");
+}
+
+// The in and not_in rules of enums.
+class EnumMembershipRule final : public NativeRule {
+ public:
+  EnumMembershipRule(IntSet values, bool negated) : values_(std::move(values)), negated_(negated) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    return value.IsInt64() && values_.contains(value.Int64OrDie()) != negated_;
+  }
+
+  [[nodiscard]] const IntSet* IntMembership(bool* negated) const override {
+    *negated = negated_;
+    return &values_;
+  }
+
+ private:
+  IntSet values_;
+  bool negated_;
+};
+
+std::shared_ptr<const NativeRule> newEnumRule(
+    const google::protobuf::Message& rules, const google::protobuf::FieldDescriptor* ruleField) {
+  if (ruleField->name() == "const") {
+    return newNumericRule<int64_t>(rules, "const");
+  }
+  if (ruleField->name() != "in" && ruleField->name() != "not_in") {
+    return nullptr;
+  }
+  std::vector<int32_t> values;
+  ProtoField field(&rules, ruleField);
+  for (int i = 0; i < field.size(); i++) {
+    auto item = field.at(i)->variant();
+    const auto* value = absl::get_if<int64_t>(&item);
+    if (value == nullptr) {
+      return nullptr;
+    }
+    values.push_back(static_cast<int32_t>(*value));
+  }
+  return std::make_shared<EnumMembershipRule>(
+      IntSet(std::move(values)), ruleField->name() == "not_in");
+}
+
+// Returns the paths of a google.protobuf.FieldMask message, or nullptr if message is not one.
+const google::protobuf::FieldDescriptor* fieldMaskPaths(const google::protobuf::Message& message) {
+  const auto* descriptor = message.GetDescriptor();
+  if (descriptor->full_name() != "google.protobuf.FieldMask") {
+    return nullptr;
+  }
+  const auto* paths = descriptor->FindFieldByName("paths");
+  if (paths == nullptr || !paths->is_repeated() ||
+      paths->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_STRING) {
+    return nullptr;
+  }
+  return paths;
+}
+
+// A set of field mask paths, stored as a trie of their dot-separated segments. A path covers
+// another if it is equal to it, or to one of its prefixes that ends before a dot, which is the
+// same as its segments being a prefix of the other's segments.
+class PathTrie {
+ public:
+  explicit PathTrie(const std::vector<std::string>& paths) : nodes_(1) {
+    for (const auto& path : paths) {
+      size_t node = 0;
+      for (std::string_view segment : absl::StrSplit(path, '.')) {
+        auto [iter, inserted] = nodes_[node].children.try_emplace(segment, nodes_.size());
+        node = iter->second;
+        if (inserted) {
+          nodes_.emplace_back();
+        }
+      }
+      nodes_[node].terminal = true;
+    }
+  }
+
+  // Returns true if some path in the trie covers path. Runs in time linear in the length of
+  // path, however many paths the trie holds.
+  [[nodiscard]] bool covers(std::string_view path) const {
+    size_t node = 0;
+    for (std::string_view segment : absl::StrSplit(path, '.')) {
+      const auto& children = nodes_[node].children;
+      auto iter = children.find(segment);
+      if (iter == children.end()) {
+        return false;
+      }
+      node = iter->second;
+      if (nodes_[node].terminal) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct Node {
+    absl::flat_hash_map<std::string, size_t> children;
+    bool terminal = false;
+  };
+
+  std::vector<Node> nodes_;
+};
+
+// The in and not_in rules of field masks. Passes masks whose paths are all covered by a path of
+// the rule, or, when negated, none of which are.
+class FieldMaskMembershipRule final : public NativeRule {
+ public:
+  FieldMaskMembershipRule(PathTrie paths, bool negated)
+      : paths_(std::move(paths)), negated_(negated) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    if (!value.IsMessage()) {
+      return false;
+    }
+    const auto& message = *value.MessageOrDie();
+    const auto* field = fieldMaskPaths(message);
+    if (field == nullptr) {
+      return false;
+    }
+    const auto* reflection = message.GetReflection();
+    std::string scratch;
+    for (int i = 0, size = reflection->FieldSize(message, field); i < size; i++) {
+      const auto& path = reflection->GetRepeatedStringReference(message, field, i, &scratch);
+      if (paths_.covers(path) == negated_) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  PathTrie paths_;
+  bool negated_;
+};
+
+// The const rule of field masks, which passes masks with exactly the same paths, in order.
+class FieldMaskConstRule final : public NativeRule {
+ public:
+  explicit FieldMaskConstRule(std::vector<std::string> paths) : paths_(std::move(paths)) {}
+
+  [[nodiscard]] bool Passes(const cel::runtime::CelValue& value) const override {
+    if (!value.IsMessage()) {
+      return false;
+    }
+    const auto& message = *value.MessageOrDie();
+    const auto* field = fieldMaskPaths(message);
+    if (field == nullptr) {
+      return false;
+    }
+    const auto* reflection = message.GetReflection();
+    if (reflection->FieldSize(message, field) != static_cast<int>(paths_.size())) {
+      return false;
+    }
+    std::string scratch;
+    for (int i = 0; i < static_cast<int>(paths_.size()); i++) {
+      if (reflection->GetRepeatedStringReference(message, field, i, &scratch) != paths_[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::vector<std::string> paths_;
+};
+
+std::shared_ptr<const NativeRule> newFieldMaskRule(
+    const google::protobuf::Message& rules, const google::protobuf::FieldDescriptor* ruleField) {
+  std::vector<std::string> paths;
+  ProtoField field(&rules, ruleField);
+  if (ruleField->name() == "const") {
+    auto value = field.variant();
+    const auto* mask = absl::get_if<const google::protobuf::Message*>(&value);
+    const auto* pathsField = mask == nullptr ? nullptr : fieldMaskPaths(**mask);
+    if (pathsField == nullptr) {
+      return nullptr;
+    }
+    const auto* reflection = (*mask)->GetReflection();
+    for (int i = 0, size = reflection->FieldSize(**mask, pathsField); i < size; i++) {
+      paths.push_back(reflection->GetRepeatedString(**mask, pathsField, i));
+    }
+    return std::make_shared<FieldMaskConstRule>(std::move(paths));
+  }
+  if (ruleField->name() != "in" && ruleField->name() != "not_in") {
+    return nullptr;
+  }
+  for (int i = 0; i < field.size(); i++) {
+    auto item = field.at(i)->variant();
+    const auto* path = absl::get_if<std::string>(&item);
+    if (path == nullptr) {
+      return nullptr;
+    }
+    paths.push_back(*path);
+  }
+  return std::make_shared<FieldMaskMembershipRule>(
+      PathTrie(paths), ruleField->name() == "not_in");
+}
+
+} // namespace
+
+IntSet::IntSet(std::vector<int32_t> values) {
+  // Bitmaps are used for ranges of up to 64Ki values, which take at most 8KiB.
+  static constexpr int64_t kMaxBitmapRange = int64_t{1} << 16;
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  if (values.empty()) {
+    return;
+  }
+  int64_t range = int64_t{values.back()} - values.front() + 1;
+  if (range > kMaxBitmapRange) {
+    sorted_ = std::move(values);
+    return;
+  }
+  min_ = values.front();
+  max_ = values.back();
+  bits_.resize((range + 63) / 64);
+  for (int32_t value : values) {
+    auto offset = static_cast<uint64_t>(value - min_);
+    bits_[offset / 64] |= uint64_t{1} << (offset % 64);
+  }
+}
+
+std::shared_ptr<const NativeRule> NewNativeRule(
+    const google::protobuf::Message& rules, const google::protobuf::FieldDescriptor* ruleField) {
+  // Only standard rules have known semantics; predefined rules are extensions.
+  if (ruleField->is_extension() || ruleField->containing_type() != rules.GetDescriptor()) {
+    return nullptr;
+  }
+  static const auto* const kSignedRules = new absl::flat_hash_set<std::string_view>{
+      "buf.validate.Int32Rules",
+      "buf.validate.Int64Rules",
+      "buf.validate.SInt32Rules",
+      "buf.validate.SInt64Rules",
+      "buf.validate.SFixed32Rules",
+      "buf.validate.SFixed64Rules",
+  };
+  static const auto* const kUnsignedRules = new absl::flat_hash_set<std::string_view>{
+      "buf.validate.UInt32Rules",
+      "buf.validate.UInt64Rules",
+      "buf.validate.Fixed32Rules",
+      "buf.validate.Fixed64Rules",
+  };
+  static const auto* const kFloatingRules = new absl::flat_hash_set<std::string_view>{
+      "buf.validate.FloatRules",
+      "buf.validate.DoubleRules",
+  };
+  const auto& type = rules.GetDescriptor()->full_name();
+  if (ruleField->is_repeated() && (ruleField->name() == "in" || ruleField->name() == "not_in")) {
+    if (kSignedRules->contains(type)) {
+      return newMembershipRule<int64_t>(rules, ruleField, ValueKind::kInt);
+    }
+    if (kUnsignedRules->contains(type)) {
+      return newMembershipRule<uint64_t>(rules, ruleField, ValueKind::kUint);
+    }
+    if (kFloatingRules->contains(type)) {
+      return newMembershipRule<double>(rules, ruleField, ValueKind::kDouble);
+    }
+    if (type == "buf.validate.StringRules") {
+      return newMembershipRule<std::string>(rules, ruleField, ValueKind::kString);
+    }
+    if (type == "buf.validate.BytesRules") {
+      return newMembershipRule<std::string>(rules, ruleField, ValueKind::kBytes);
+    }
+    if (type == "buf.validate.DurationRules") {
+      return newMembershipRule<absl::Duration>(rules, ruleField, ValueKind::kDuration);
+    }
+    if (type == "buf.validate.EnumRules") {
+      return newEnumRule(rules, ruleField);
+    }
+    if (type == "buf.validate.FieldMaskRules") {
+      return newFieldMaskRule(rules, ruleField);
+    }
+    return nullptr;
+  }
+  if (kSignedRules->contains(type)) {
+    return newNumericRule<int64_t>(rules, ruleField->name());
+  }
+  if (kUnsignedRules->contains(type)) {
+    return newNumericRule<uint64_t>(rules, ruleField->name());
+  }
+  if (kFloatingRules->contains(type)) {
+    return newNumericRule<double>(rules, ruleField->name());
+  }
+  if (type == "buf.validate.StringRules") {
+    if (ruleField->name() == "pattern") {
+      return newPatternRule(rules);
+    }
+    return newTextRule(rules, ruleField->name(), /*bytes=*/false);
+  }
+  if (type == "buf.validate.BytesRules") {
+    return newTextRule(rules, ruleField->name(), /*bytes=*/true);
+  }
+  if (type == "buf.validate.EnumRules") {
+    return newEnumRule(rules, ruleField);
+  }
+  if (type == "buf.validate.DurationRules") {
+    return newNumericRule<absl::Duration>(rules, ruleField->name());
+  }
+  if (type == "buf.validate.TimestampRules") {
+    return newTimestampRule(rules, ruleField->name());
+  }
+  if (type == "buf.validate.FieldMaskRules") {
+    return newFieldMaskRule(rules, ruleField);
+  }
+  return nullptr;
+}
+
+} // namespace buf::validate::internal
@@ -0,0 +1,110 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "eval/public/cel_value.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+
+namespace buf::validate::internal {
+
+class IntSet;
+
+/// A native implementation of a standard rule, used to avoid evaluating the rule's CEL expression.
+///
+/// A native rule only decides whether a value passes. Values it does not pass are evaluated with
+/// CEL as before, so violations are always reported by the expression itself, with exactly the
+/// same id and message.
+class NativeRule {
+ public:
+  NativeRule() = default;
+  virtual ~NativeRule() = default;
+
+  NativeRule(const NativeRule&) = delete;
+  void operator=(const NativeRule&) = delete;
+
+  /// Returns true if value is known to satisfy the rule, and false if it does not, or if the
+  /// native rule cannot decide.
+  [[nodiscard]] virtual bool Passes(const google::api::expr::runtime::CelValue& value) const = 0;
+
+  /// Returns true if the rule depends on the `now` variable. Such rules cannot decide anything
+  /// from Passes alone, and are checked with PassesAt instead.
+  [[nodiscard]] virtual bool UsesNow() const { return false; }
+
+  /// Like Passes, for a validation that sees now as the current time.
+  [[nodiscard]] virtual bool PassesAt(
+      const google::api::expr::runtime::CelValue& value, absl::Time /*now*/) const {
+    return Passes(value);
+  }
+
+  /// Returns true if value is known to violate the rule. The rule's expression is then evaluated
+  /// against Witness() instead, which must be cheaper to evaluate and violate the rule with the
+  /// same violation as every value this returns true for.
+  [[nodiscard]] virtual bool Fails(const google::api::expr::runtime::CelValue& /*value*/) const {
+    return false;
+  }
+
+  /// Returns a value that violates the rule, if Fails can return true.
+  [[nodiscard]] virtual google::api::expr::runtime::CelValue Witness() const {
+    return google::api::expr::runtime::CelValue::CreateNull();
+  }
+
+  /// Returns the set of integers the rule passes, or nullptr if it is not such a rule. If negated
+  /// is set, the rule passes exactly the integers that are not in the set instead.
+  [[nodiscard]] virtual const IntSet* IntMembership(bool* /*negated*/) const { return nullptr; }
+};
+
+/// An immutable set of 32-bit integers, such as enum values. Sets whose values span a small range
+/// are stored as a dense bitmap over that range, others as a sorted array.
+class IntSet {
+ public:
+  IntSet() = default;
+  explicit IntSet(std::vector<int32_t> values);
+
+  [[nodiscard]] bool contains(int64_t value) const {
+    if (!bits_.empty()) {
+      if (value < min_ || value > max_) {
+        return false;
+      }
+      auto offset = static_cast<uint64_t>(value - min_);
+      return ((bits_[offset / 64] >> (offset % 64)) & 1) != 0;
+    }
+    return std::binary_search(sorted_.begin(), sorted_.end(), value);
+  }
+
+  [[nodiscard]] size_t SpaceUsed() const {
+    return bits_.capacity() * sizeof(uint64_t) + sorted_.capacity() * sizeof(int32_t);
+  }
+
+ private:
+  int64_t min_ = 0;
+  int64_t max_ = -1;
+  std::vector<uint64_t> bits_;
+  std::vector<int32_t> sorted_;
+};
+
+/// Returns a native implementation of the standard rule ruleField, as set in rules, or nullptr
+/// if there is none. Constants are copied out of rules, which need not outlive the result.
+std::shared_ptr<const NativeRule> NewNativeRule(
+    const google::protobuf::Message& rules, const google::protobuf::FieldDescriptor* ruleField);
+
+} // namespace buf::validate::internal
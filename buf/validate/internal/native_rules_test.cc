@@ -0,0 +1,369 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/native_rules.h"
+
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <string>
+
+#include "absl/time/time.h"
+#include "buf/validate/validate.pb.h"
+#include "eval/public/structs/cel_proto_wrapper.h"
+#include "google/protobuf/field_mask.pb.h"
+#include "gtest/gtest.h"
+
+namespace buf::validate::internal {
+namespace {
+
+using google::api::expr::runtime::CelValue;
+
+std::shared_ptr<const NativeRule> newRule(
+    const google::protobuf::Message& rules, const std::string& name) {
+  return NewNativeRule(rules, rules.GetDescriptor()->FindFieldByName(name));
+}
+
+TEST(NativeRuleTest, SignedRange) {
+  Int32Rules rules;
+  rules.set_gt(1);
+  rules.set_lte(5);
+  auto rule = newRule(rules, "gt");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_FALSE(rule->Passes(CelValue::CreateInt64(1)));
+  EXPECT_TRUE(rule->Passes(CelValue::CreateInt64(2)));
+  EXPECT_TRUE(rule->Passes(CelValue::CreateInt64(5)));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateInt64(6)));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateUint64(3)));
+}
+
+TEST(NativeRuleTest, ExclusiveRangeNeverPasses) {
+  Int32Rules rules;
+  rules.set_lt(1);
+  rules.set_gt(5);
+  auto rule = newRule(rules, "lt");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_FALSE(rule->Passes(CelValue::CreateInt64(0)));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateInt64(3)));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateInt64(6)));
+}
+
+TEST(NativeRuleTest, UnsignedConst) {
+  UInt64Rules rules;
+  rules.set_const_(42);
+  auto rule = newRule(rules, "const");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_TRUE(rule->Passes(CelValue::CreateUint64(42)));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateUint64(41)));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateInt64(42)));
+}
+
+TEST(NativeRuleTest, DoubleRangeAndFinite) {
+  DoubleRules rules;
+  rules.set_gte(0);
+  rules.set_finite(true);
+  auto range = newRule(rules, "gte");
+  ASSERT_NE(range, nullptr);
+  EXPECT_TRUE(range->Passes(CelValue::CreateDouble(0)));
+  EXPECT_FALSE(range->Passes(CelValue::CreateDouble(-0.5)));
+  EXPECT_FALSE(range->Passes(CelValue::CreateDouble(std::nan(""))));
+  auto finite = newRule(rules, "finite");
+  ASSERT_NE(finite, nullptr);
+  EXPECT_TRUE(finite->Passes(CelValue::CreateDouble(1.5)));
+  EXPECT_FALSE(finite->Passes(CelValue::CreateDouble(std::numeric_limits<double>::infinity())));
+  EXPECT_FALSE(finite->Passes(CelValue::CreateDouble(std::nan(""))));
+}
+
+TEST(NativeRuleTest, NanBoundFallsBack) {
+  DoubleRules rules;
+  rules.set_lt(std::nan(""));
+  EXPECT_EQ(newRule(rules, "lt"), nullptr);
+}
+
+TEST(NativeRuleTest, StringLength) {
+  StringRules rules;
+  rules.set_min_len(2);
+  rules.set_max_bytes(4);
+  auto minLen = newRule(rules, "min_len");
+  ASSERT_NE(minLen, nullptr);
+  std::string twoCodePoints = "\xc3\xa9\xc3\xa9";
+  EXPECT_TRUE(minLen->Passes(CelValue::CreateStringView(twoCodePoints)));
+  EXPECT_FALSE(minLen->Passes(CelValue::CreateStringView("\xc3\xa9")));
+  EXPECT_FALSE(minLen->Passes(CelValue::CreateStringView("\xc3\xc3")));
+  EXPECT_FALSE(minLen->Passes(CelValue::CreateBytesView("ab")));
+  auto maxBytes = newRule(rules, "max_bytes");
+  ASSERT_NE(maxBytes, nullptr);
+  EXPECT_TRUE(maxBytes->Passes(CelValue::CreateStringView(twoCodePoints)));
+  EXPECT_FALSE(maxBytes->Passes(CelValue::CreateStringView("abcde")));
+}
+
+TEST(NativeRuleTest, StringText) {
+  StringRules rules;
+  rules.set_prefix("foo");
+  rules.set_not_contains("bar");
+  auto prefix = newRule(rules, "prefix");
+  ASSERT_NE(prefix, nullptr);
+  EXPECT_TRUE(prefix->Passes(CelValue::CreateStringView("foobar")));
+  EXPECT_FALSE(prefix->Passes(CelValue::CreateStringView("barfoo")));
+  auto notContains = newRule(rules, "not_contains");
+  ASSERT_NE(notContains, nullptr);
+  EXPECT_TRUE(notContains->Passes(CelValue::CreateStringView("foobaz")));
+  EXPECT_FALSE(notContains->Passes(CelValue::CreateStringView("foobar")));
+}
+
+TEST(NativeRuleTest, Bytes) {
+  BytesRules rules;
+  rules.set_len(2);
+  rules.set_suffix("\x99");
+  auto len = newRule(rules, "len");
+  ASSERT_NE(len, nullptr);
+  // Bytes lengths count bytes, not code points.
+  EXPECT_TRUE(len->Passes(CelValue::CreateBytesView("\xc3\xa9")));
+  EXPECT_FALSE(len->Passes(CelValue::CreateBytesView("abc")));
+  EXPECT_FALSE(len->Passes(CelValue::CreateStringView("ab")));
+  auto suffix = newRule(rules, "suffix");
+  ASSERT_NE(suffix, nullptr);
+  EXPECT_TRUE(suffix->Passes(CelValue::CreateBytesView("z\x99")));
+  EXPECT_FALSE(suffix->Passes(CelValue::CreateBytesView("\x99z")));
+}
+
+TEST(NativeRuleTest, PatternPrefilter) {
+  StringRules rules;
+  rules.set_pattern("^urn:acme:[a-z]+\\.json$");
+  auto rule = newRule(rules, "pattern");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_FALSE(rule->Passes(CelValue::CreateStringView("urn:acme:x.json")));
+  EXPECT_FALSE(rule->Fails(CelValue::CreateStringView("urn:acme:x.json")));
+  EXPECT_FALSE(rule->Fails(CelValue::CreateStringView("urn:acme:1.json")));
+  EXPECT_TRUE(rule->Fails(CelValue::CreateStringView("urn:other:x.json")));
+  EXPECT_TRUE(rule->Fails(CelValue::CreateStringView("urn:acme:x.jsonp")));
+  EXPECT_TRUE(rule->Fails(rule->Witness()));
+
+  rules.set_pattern("ab?c");
+  rule = newRule(rules, "pattern");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_FALSE(rule->Fails(CelValue::CreateStringView("ac")));
+  EXPECT_TRUE(rule->Fails(CelValue::CreateStringView("bc")));
+}
+
+TEST(NativeRuleTest, PatternLiteral) {
+  StringRules rules;
+  rules.set_pattern("^a\\.b$");
+  auto rule = newRule(rules, "pattern");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_TRUE(rule->Passes(CelValue::CreateStringView("a.b")));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateStringView("axb")));
+  EXPECT_TRUE(rule->Fails(CelValue::CreateStringView("axb")));
+  EXPECT_TRUE(rule->Fails(CelValue::CreateStringView("a.bc")));
+
+  rules.set_pattern("foo");
+  rule = newRule(rules, "pattern");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_TRUE(rule->Passes(CelValue::CreateStringView("xfoox")));
+  EXPECT_TRUE(rule->Fails(CelValue::CreateStringView("fo")));
+}
+
+TEST(NativeRuleTest, PatternUnsupported) {
+  StringRules rules;
+  for (const auto* pattern : {"(?i)abc", "a|b", "\\x41", "[a-z]+", "(ab"}) {
+    rules.set_pattern(pattern);
+    EXPECT_EQ(newRule(rules, "pattern"), nullptr) << pattern;
+  }
+}
+
+TEST(NativeRuleTest, IntMembership) {
+  Int64Rules rules;
+  for (int64_t i = 0; i < 100; i += 2) {
+    rules.add_in(i);
+  }
+  rules.add_not_in(4);
+  auto in = newRule(rules, "in");
+  ASSERT_NE(in, nullptr);
+  EXPECT_TRUE(in->Passes(CelValue::CreateInt64(42)));
+  EXPECT_FALSE(in->Passes(CelValue::CreateInt64(43)));
+  EXPECT_FALSE(in->Passes(CelValue::CreateUint64(42)));
+  auto notIn = newRule(rules, "not_in");
+  ASSERT_NE(notIn, nullptr);
+  EXPECT_TRUE(notIn->Passes(CelValue::CreateInt64(42)));
+  EXPECT_FALSE(notIn->Passes(CelValue::CreateInt64(4)));
+}
+
+TEST(NativeRuleTest, DoubleMembership) {
+  DoubleRules rules;
+  for (double value : {3.5, 0.0, -1.0, std::nan(""), 2.0}) {
+    rules.add_in(value);
+    rules.add_not_in(value);
+  }
+  auto in = newRule(rules, "in");
+  ASSERT_NE(in, nullptr);
+  EXPECT_TRUE(in->Passes(CelValue::CreateDouble(-0.0)));
+  EXPECT_TRUE(in->Passes(CelValue::CreateDouble(3.5)));
+  EXPECT_FALSE(in->Passes(CelValue::CreateDouble(1.0)));
+  EXPECT_FALSE(in->Passes(CelValue::CreateDouble(std::nan(""))));
+  auto notIn = newRule(rules, "not_in");
+  ASSERT_NE(notIn, nullptr);
+  EXPECT_TRUE(notIn->Passes(CelValue::CreateDouble(std::nan(""))));
+  EXPECT_FALSE(notIn->Passes(CelValue::CreateDouble(-1.0)));
+}
+
+TEST(NativeRuleTest, StringMembership) {
+  StringRules rules;
+  for (int i = 0; i < 20; i++) {
+    rules.add_in("value" + std::to_string(i));
+  }
+  auto in = newRule(rules, "in");
+  ASSERT_NE(in, nullptr);
+  EXPECT_TRUE(in->Passes(CelValue::CreateStringView("value7")));
+  EXPECT_FALSE(in->Passes(CelValue::CreateStringView("value20")));
+  EXPECT_FALSE(in->Passes(CelValue::CreateBytesView("value7")));
+}
+
+TEST(NativeRuleTest, DurationMembership) {
+  DurationRules rules;
+  auto* allowed = rules.add_in();
+  allowed->set_seconds(1);
+  allowed->set_nanos(500);
+  auto in = newRule(rules, "in");
+  ASSERT_NE(in, nullptr);
+  EXPECT_TRUE(in->Passes(CelValue::CreateDuration(absl::Seconds(1) + absl::Nanoseconds(500))));
+  EXPECT_FALSE(in->Passes(CelValue::CreateDuration(absl::Seconds(1))));
+}
+
+TEST(NativeRuleTest, DurationRange) {
+  DurationRules rules;
+  rules.mutable_gte()->set_seconds(1);
+  rules.mutable_lt()->set_seconds(2);
+  auto rule = newRule(rules, "lt");
+  ASSERT_NE(rule, nullptr);
+  EXPECT_TRUE(rule->Passes(CelValue::CreateDuration(absl::Seconds(1))));
+  EXPECT_TRUE(rule->Passes(CelValue::CreateDuration(absl::Milliseconds(1999))));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateDuration(absl::Seconds(2))));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateDuration(absl::Nanoseconds(999999999))));
+  EXPECT_FALSE(rule->Passes(CelValue::CreateInt64(1)));
+}
+
+TEST(NativeRuleTest, TimestampRangeAndConst) {
+  TimestampRules rules;
+  rules.mutable_gt()->set_seconds(100);
+  auto range = newRule(rules, "gt");
+  ASSERT_NE(range, nullptr);
+  EXPECT_TRUE(range->Passes(CelValue::CreateTimestamp(absl::FromUnixSeconds(101))));
+  EXPECT_FALSE(range->Passes(CelValue::CreateTimestamp(absl::FromUnixSeconds(100))));
+  rules.mutable_const_()->set_nanos(5);
+  auto constant = newRule(rules, "const");
+  ASSERT_NE(constant, nullptr);
+  EXPECT_TRUE(constant->Passes(CelValue::CreateTimestamp(absl::FromUnixNanos(5))));
+  EXPECT_FALSE(constant->Passes(CelValue::CreateTimestamp(absl::FromUnixNanos(6))));
+}
+
+TEST(NativeRuleTest, TimestampNow) {
+  const absl::Time now = absl::FromUnixSeconds(1000);
+  TimestampRules rules;
+  rules.set_lt_now(true);
+  rules.set_gt_now(false);
+  rules.mutable_within()->set_seconds(10);
+  auto ltNow = newRule(rules, "lt_now");
+  ASSERT_NE(ltNow, nullptr);
+  EXPECT_TRUE(ltNow->UsesNow());
+  EXPECT_TRUE(ltNow->PassesAt(CelValue::CreateTimestamp(now - absl::Seconds(1)), now));
+  // Values on a bound are left to CEL.
+  EXPECT_FALSE(ltNow->PassesAt(CelValue::CreateTimestamp(now), now));
+  EXPECT_FALSE(ltNow->PassesAt(CelValue::CreateTimestamp(now + absl::Seconds(1)), now));
+  auto gtNow = newRule(rules, "gt_now");
+  ASSERT_NE(gtNow, nullptr);
+  EXPECT_TRUE(gtNow->PassesAt(CelValue::CreateTimestamp(now - absl::Seconds(1)), now));
+  auto within = newRule(rules, "within");
+  ASSERT_NE(within, nullptr);
+  EXPECT_TRUE(within->PassesAt(CelValue::CreateTimestamp(now + absl::Seconds(9)), now));
+  EXPECT_FALSE(within->PassesAt(CelValue::CreateTimestamp(now - absl::Seconds(11)), now));
+  // Bounds that overflow the range of CEL timestamps are left to CEL, which reports an error.
+  const absl::Time last = absl::FromUnixSeconds(253402300799);
+  EXPECT_FALSE(within->PassesAt(CelValue::CreateTimestamp(last), last));
+}
+
+TEST(NativeRuleTest, FieldMaskMembership) {
+  FieldMaskRules rules;
+  rules.add_in("a");
+  rules.add_in("b.c");
+  rules.add_not_in("b.c.d");
+  auto in = newRule(rules, "in");
+  auto notIn = newRule(rules, "not_in");
+  ASSERT_NE(in, nullptr);
+  ASSERT_NE(notIn, nullptr);
+  google::protobuf::Arena arena;
+  auto mask = [&](std::initializer_list<const char*> paths) {
+    auto* message = google::protobuf::Arena::Create<google::protobuf::FieldMask>(&arena);
+    for (const char* path : paths) {
+      message->add_paths(path);
+    }
+    return google::api::expr::runtime::CelProtoWrapper::CreateMessage(message, &arena);
+  };
+  EXPECT_TRUE(in->Passes(mask({})));
+  EXPECT_TRUE(in->Passes(mask({"a", "a.x.y", "b.c", "b.c.d"})));
+  EXPECT_FALSE(in->Passes(mask({"a", "ab"})));
+  EXPECT_FALSE(in->Passes(mask({"b"})));
+  EXPECT_FALSE(in->Passes(mask({"b.cd"})));
+  EXPECT_TRUE(notIn->Passes(mask({"b.c", "b.c.e", "b.cd"})));
+  EXPECT_FALSE(notIn->Passes(mask({"b.c.d.e"})));
+  EXPECT_FALSE(in->Passes(CelValue::CreateStringView("a")));
+
+  rules.mutable_const_()->add_paths("a");
+  auto constant = newRule(rules, "const");
+  ASSERT_NE(constant, nullptr);
+  EXPECT_TRUE(constant->Passes(mask({"a"})));
+  EXPECT_FALSE(constant->Passes(mask({"a", "b"})));
+}
+
+TEST(IntSetTest, Contains) {
+  IntSet dense({3, -2, 7, 3});
+  EXPECT_TRUE(dense.contains(-2));
+  EXPECT_TRUE(dense.contains(7));
+  EXPECT_FALSE(dense.contains(0));
+  EXPECT_FALSE(dense.contains(8));
+  EXPECT_FALSE(dense.contains(int64_t{1} << 40));
+  IntSet sparse({0, 1 << 30, -(1 << 30)});
+  EXPECT_TRUE(sparse.contains(1 << 30));
+  EXPECT_FALSE(sparse.contains(1));
+  EXPECT_FALSE(IntSet().contains(0));
+}
+
+TEST(NativeRuleTest, EnumMembership) {
+  EnumRules rules;
+  rules.add_not_in(2);
+  auto notIn = newRule(rules, "not_in");
+  ASSERT_NE(notIn, nullptr);
+  EXPECT_TRUE(notIn->Passes(CelValue::CreateInt64(1)));
+  EXPECT_FALSE(notIn->Passes(CelValue::CreateInt64(2)));
+
+  // The set is exposed, so that repeated enums can be checked without building values.
+  bool negated = false;
+  const auto* set = notIn->IntMembership(&negated);
+  ASSERT_NE(set, nullptr);
+  EXPECT_TRUE(negated);
+  EXPECT_TRUE(set->contains(2));
+  EXPECT_FALSE(set->contains(1));
+  rules.add_in(3);
+  auto in = newRule(rules, "in");
+  ASSERT_NE(in, nullptr);
+  set = in->IntMembership(&negated);
+  ASSERT_NE(set, nullptr);
+  EXPECT_FALSE(negated);
+  EXPECT_TRUE(set->contains(3));
+  rules.set_const_(3);
+  EXPECT_EQ(newRule(rules, "const")->IntMembership(&negated), nullptr);
+}
+
+} // namespace
+} // namespace buf::validate::internal
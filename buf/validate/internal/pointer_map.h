@@ -0,0 +1,138 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "absl/hash/hash.h"
+
+namespace buf::validate::internal {
+
+/// An insert-only hash map from pointers to pointers, built for read-mostly workloads.
+///
+/// Find is wait-free: it only performs acquire loads, and never takes a lock or executes an atomic
+/// read-modify-write, so concurrent readers do not bounce a shared cache line between cores.
+/// Insert must be externally serialized, typically by holding a mutex. When the table fills up,
+/// a copy with twice the capacity is published and the old table is retired; retired tables are
+/// kept alive until the map is destroyed so that in-flight readers never observe freed memory.
+/// Because capacity doubles, retired tables never use more memory than the live table.
+template <typename K, typename V>
+class PointerMap {
+ public:
+  PointerMap() : table_(new Table(kInitialCapacity)) {}
+
+  ~PointerMap() {
+    delete table_.load(std::memory_order_relaxed);
+    for (const Table* table : retired_) {
+      delete table;
+    }
+  }
+
+  PointerMap(const PointerMap&) = delete;
+  PointerMap& operator=(const PointerMap&) = delete;
+
+  /// Returns the value stored for key, or nullptr if there is none. May be called concurrently
+  /// with other calls to Find and with a single writer calling Insert.
+  [[nodiscard]] V* Find(const K* key) const {
+    const Table* table = table_.load(std::memory_order_acquire);
+    for (size_t i = hash(key) & table->mask;; i = (i + 1) & table->mask) {
+      const K* slotKey = table->slots[i].key.load(std::memory_order_acquire);
+      if (slotKey == key) {
+        return table->slots[i].value.load(std::memory_order_acquire);
+      }
+      if (slotKey == nullptr) {
+        return nullptr;
+      }
+    }
+  }
+
+  /// Stores value for key, replacing any existing value. Calls to Insert must not race with each
+  /// other.
+  void Insert(const K* key, V* value) {
+    Table* table = table_.load(std::memory_order_relaxed);
+    if (Table::Store(*table, key, value)) {
+      return;
+    }
+    if ((size_ + 1) * 2 > table->mask + 1) {
+      auto* grown = new Table((table->mask + 1) * 2);
+      for (size_t i = 0; i <= table->mask; i++) {
+        const K* slotKey = table->slots[i].key.load(std::memory_order_relaxed);
+        if (slotKey != nullptr) {
+          Table::Add(*grown, slotKey, table->slots[i].value.load(std::memory_order_relaxed));
+        }
+      }
+      table_.store(grown, std::memory_order_release);
+      retired_.push_back(table);
+      table = grown;
+    }
+    Table::Add(*table, key, value);
+    size_++;
+  }
+
+  /// Returns the number of keys in the map. Must not race with Insert.
+  [[nodiscard]] size_t size() const { return size_; }
+
+ private:
+  static constexpr size_t kInitialCapacity = 64;
+
+  struct Slot {
+    std::atomic<const K*> key{nullptr};
+    std::atomic<V*> value{nullptr};
+  };
+
+  struct Table {
+    explicit Table(size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) {}
+
+    // Replaces the value for an existing key, returning false if the key is absent.
+    static bool Store(Table& table, const K* key, V* value) {
+      for (size_t i = hash(key) & table.mask;; i = (i + 1) & table.mask) {
+        const K* slotKey = table.slots[i].key.load(std::memory_order_relaxed);
+        if (slotKey == key) {
+          table.slots[i].value.store(value, std::memory_order_release);
+          return true;
+        }
+        if (slotKey == nullptr) {
+          return false;
+        }
+      }
+    }
+
+    // Claims an empty slot for a key known to be absent. The value is written before the key is
+    // published, so a reader that observes the key also observes the value.
+    static void Add(Table& table, const K* key, V* value) {
+      for (size_t i = hash(key) & table.mask;; i = (i + 1) & table.mask) {
+        if (table.slots[i].key.load(std::memory_order_relaxed) == nullptr) {
+          table.slots[i].value.store(value, std::memory_order_relaxed);
+          table.slots[i].key.store(key, std::memory_order_release);
+          return;
+        }
+      }
+    }
+
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  static size_t hash(const K* key) { return absl::Hash<const K*>{}(key); }
+
+  std::atomic<Table*> table_;
+  std::vector<const Table*> retired_;
+  size_t size_ = 0;
+};
+
+} // namespace buf::validate::internal
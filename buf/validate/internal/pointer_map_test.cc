@@ -0,0 +1,76 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/pointer_map.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace buf::validate::internal {
+namespace {
+
+TEST(PointerMapTest, InsertAndFind) {
+  PointerMap<int, const int> map;
+  int a = 1;
+  int b = 2;
+  EXPECT_EQ(map.Find(&a), nullptr);
+  map.Insert(&a, &b);
+  EXPECT_EQ(map.Find(&a), &b);
+  EXPECT_EQ(map.Find(&b), nullptr);
+  map.Insert(&a, &a);
+  EXPECT_EQ(map.Find(&a), &a);
+  EXPECT_EQ(map.size(), 1);
+}
+
+TEST(PointerMapTest, Grow) {
+  PointerMap<int, const int> map;
+  std::vector<int> keys(10000);
+  for (const auto& key : keys) {
+    map.Insert(&key, &key);
+  }
+  EXPECT_EQ(map.size(), keys.size());
+  for (const auto& key : keys) {
+    EXPECT_EQ(map.Find(&key), &key);
+  }
+}
+
+TEST(PointerMapTest, ConcurrentReaders) {
+  PointerMap<int, const int> map;
+  std::vector<int> keys(10000);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&] {
+      for (int pass = 0; pass < 10; pass++) {
+        for (const auto& key : keys) {
+          const int* value = map.Find(&key);
+          ASSERT_TRUE(value == nullptr || value == &key);
+        }
+      }
+    });
+  }
+  for (const auto& key : keys) {
+    map.Insert(&key, &key);
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  for (const auto& key : keys) {
+    EXPECT_EQ(map.Find(&key), &key);
+  }
+}
+
+} // namespace
+} // namespace buf::validate::internal
@@ -0,0 +1,122 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/regex_cache.h"
+
+#include <utility>
+
+#include "eval/public/cel_function_adapter.h"
+#include "eval/public/cel_value.h"
+#include "google/protobuf/arena.h"
+
+namespace buf::validate::internal {
+namespace cel = google::api::expr::runtime;
+
+std::shared_ptr<const re2::RE2> RegexCache::Get(std::string_view pattern) {
+  int64_t maxMemory;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    if (auto iter = entries_.find(pattern); iter != entries_.end()) {
+      // Only write the flag when it changes, to keep the cache line shared between readers.
+      if (!iter->second.referenced.load(std::memory_order_relaxed)) {
+        iter->second.referenced.store(true, std::memory_order_relaxed);
+      }
+      return iter->second.regex;
+    }
+    maxMemory = maxMemory_;
+  }
+  // Compile outside the lock, so that a slow pattern does not block lookups of other patterns.
+  re2::RE2::Options options;
+  options.set_log_errors(false);
+  options.set_max_mem(maxMemory);
+  auto regex = std::make_shared<const re2::RE2>(pattern, options);
+  absl::WriterMutexLock lock(&mutex_);
+  if (maxMemory != maxMemory_) {
+    return regex;
+  }
+  if (auto iter = entries_.find(pattern); iter != entries_.end()) {
+    return iter->second.regex;
+  }
+  if (capacity_ == 0) {
+    return regex;
+  }
+  EvictLocked();
+  entries_[pattern].regex = regex;
+  clock_.emplace_back(pattern);
+  return regex;
+}
+
+void RegexCache::EvictLocked() {
+  // Lookups only set flags with the lock held for reading, so within two passes of the hand,
+  // every flag has been cleared and a pattern is evicted.
+  while (entries_.size() >= capacity_ && !clock_.empty()) {
+    if (clockHand_ >= clock_.size()) {
+      clockHand_ = 0;
+    }
+    auto iter = entries_.find(clock_[clockHand_]);
+    if (iter->second.referenced.exchange(false, std::memory_order_relaxed)) {
+      clockHand_++;
+      continue;
+    }
+    entries_.erase(iter);
+    clock_[clockHand_] = std::move(clock_.back());
+    clock_.pop_back();
+  }
+}
+
+void RegexCache::SetMaxMemory(int64_t bytes) {
+  absl::WriterMutexLock lock(&mutex_);
+  if (bytes != maxMemory_) {
+    maxMemory_ = bytes;
+    entries_.clear();
+    clock_.clear();
+    clockHand_ = 0;
+  }
+}
+
+size_t RegexCache::size() const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return entries_.size();
+}
+
+absl::Status RegisterCachedRegexFuncs(
+    cel::CelFunctionRegistry& registry, RegexCache& cache, int maxProgramSize) {
+  // Matches the built-in implementation: a partial match, with an error for invalid patterns and
+  // for patterns over the program size limit.
+  auto matches = [&cache, maxProgramSize](
+                     google::protobuf::Arena* arena,
+                     cel::CelValue::StringHolder target,
+                     cel::CelValue::StringHolder pattern) -> cel::CelValue {
+    auto regex = cache.Get(pattern.value());
+    if (maxProgramSize > 0 && regex->ProgramSize() > maxProgramSize) {
+      return cel::CreateErrorValue(
+          arena, "exceeded RE2 max program size", absl::StatusCode::kInvalidArgument);
+    }
+    if (!regex->ok()) {
+      return cel::CreateErrorValue(arena, "invalid_argument", absl::StatusCode::kInvalidArgument);
+    }
+    return cel::CelValue::CreateBool(re2::RE2::PartialMatch(target.value(), *regex));
+  };
+  using Adapter = cel::
+      FunctionAdapter<cel::CelValue, cel::CelValue::StringHolder, cel::CelValue::StringHolder>;
+  for (bool receiverStyle : {false, true}) {
+    auto status = Adapter::CreateAndRegister("matches", receiverStyle, matches, &registry);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+} // namespace buf::validate::internal
@@ -0,0 +1,88 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/node_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "eval/public/cel_function_registry.h"
+#include "re2/re2.h"
+
+namespace buf::validate::internal {
+
+/// A thread-safe, bounded cache of compiled regular expressions, keyed by pattern text.
+///
+/// Patterns that fail to compile are cached too, so that an invalid pattern is only compiled
+/// once. When the cache is full, a CLOCK hand evicts a pattern that has not been used since the
+/// hand last passed it, approximating least recently used eviction without taking a write lock
+/// on lookups.
+class RegexCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 1024;
+
+  explicit RegexCache(size_t capacity = kDefaultCapacity) : capacity_(capacity) {}
+  RegexCache(const RegexCache&) = delete;
+  void operator=(const RegexCache&) = delete;
+
+  /// Returns the compiled form of pattern, compiling it if it is not in the cache yet. The
+  /// result may not be ok() if the pattern is invalid or exceeds the memory limit.
+  std::shared_ptr<const re2::RE2> Get(std::string_view pattern);
+
+  /// Sets the RE2 max_mem option used to compile patterns, and drops every pattern compiled with
+  /// the previous limit.
+  void SetMaxMemory(int64_t bytes);
+
+  [[nodiscard]] size_t size() const;
+
+ private:
+  struct Entry {
+    std::shared_ptr<const re2::RE2> regex;
+    // Set on each use after the first, and cleared by the clock hand, so that a pattern used
+    // only once is evicted before patterns that are used repeatedly.
+    std::atomic<bool> referenced{false};
+  };
+
+  const size_t capacity_;
+  mutable absl::Mutex mutex_;
+  int64_t maxMemory_ ABSL_GUARDED_BY(mutex_) = re2::RE2::Options().max_mem();
+  // node_hash_map, since entries hold an atomic and are not movable.
+  absl::node_hash_map<std::string, Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // The cached patterns, in the order the clock hand visits them.
+  std::vector<std::string> clock_ ABSL_GUARDED_BY(mutex_);
+  size_t clockHand_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // Evicts patterns until there is room for a new one.
+  void EvictLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+};
+
+/// Registers the `matches` functions, in both global and receiver style, implemented with
+/// regexes from cache, which must outlive the registry. Expression builders that use it must be
+/// created with the built-in regex functions disabled. As with the built-in functions, patterns
+/// whose RE2 program is larger than maxProgramSize fail to match with an error, unless
+/// maxProgramSize is zero.
+absl::Status RegisterCachedRegexFuncs(
+    google::api::expr::runtime::CelFunctionRegistry& registry,
+    RegexCache& cache,
+    int maxProgramSize = 0);
+
+} // namespace buf::validate::internal
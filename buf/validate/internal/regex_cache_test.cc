@@ -0,0 +1,103 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/regex_cache.h"
+
+#include "buf/validate/internal/rules.h"
+#include "eval/public/activation.h"
+#include "eval/public/builtin_func_registrar.h"
+#include "eval/public/cel_expr_builder_factory.h"
+#include "google/protobuf/arena.h"
+#include "gtest/gtest.h"
+#include "parser/parser.h"
+
+namespace buf::validate::internal {
+namespace {
+
+namespace cel = google::api::expr;
+
+TEST(RegexCacheTest, CachesPatterns) {
+  RegexCache cache(2);
+  auto first = cache.Get("^a+$");
+  ASSERT_TRUE(first->ok());
+  EXPECT_EQ(cache.Get("^a+$"), first);
+  EXPECT_FALSE(cache.Get("(")->ok());
+  EXPECT_EQ(cache.size(), 2);
+  // The pattern that was not used again is evicted, not the one that was.
+  ASSERT_TRUE(cache.Get("b")->ok());
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.Get("^a+$"), first);
+  cache.SetMaxMemory(1 << 20);
+  EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(RegexCacheTest, Matches) {
+  google::protobuf::Arena arena;
+  RegexCache cache;
+  auto builder_or = NewRuleBuilder(&arena, &cache);
+  ASSERT_TRUE(builder_or.ok()) << builder_or.status();
+  auto parsed = cel::parser::Parse("this.matches(pattern) && matches(this, pattern)");
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  auto expr_or = builder_or.value()->CreateExpression(
+      &parsed.value().expr(), &parsed.value().source_info());
+  ASSERT_TRUE(expr_or.ok()) << expr_or.status();
+
+  cel::runtime::Activation activation;
+  activation.InsertValue("this", cel::runtime::CelValue::CreateStringView("abc"));
+  activation.InsertValue("pattern", cel::runtime::CelValue::CreateStringView("^a"));
+  auto result = expr_or.value()->Evaluate(activation, &arena);
+  ASSERT_TRUE(result.ok()) << result.status();
+  ASSERT_TRUE(result.value().IsBool());
+  EXPECT_TRUE(result.value().BoolOrDie());
+  EXPECT_EQ(cache.size(), 1);
+
+  activation.RemoveValueEntry("pattern");
+  activation.InsertValue("pattern", cel::runtime::CelValue::CreateStringView("("));
+  result = expr_or.value()->Evaluate(activation, &arena);
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_TRUE(result.value().IsError());
+}
+
+TEST(RegexCacheTest, MaxProgramSize) {
+  google::protobuf::Arena arena;
+  RegexCache cache;
+  cel::runtime::InterpreterOptions options;
+  options.enable_regex = false;
+  auto builder = cel::runtime::CreateCelExpressionBuilder(options);
+  ASSERT_TRUE(cel::runtime::RegisterBuiltinFunctions(builder->GetRegistry(), options).ok());
+  ASSERT_TRUE(RegisterCachedRegexFuncs(*builder->GetRegistry(), cache, 10).ok());
+  auto parsed = cel::parser::Parse("this.matches(pattern)");
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  auto expr_or =
+      builder->CreateExpression(&parsed.value().expr(), &parsed.value().source_info());
+  ASSERT_TRUE(expr_or.ok()) << expr_or.status();
+
+  cel::runtime::Activation activation;
+  activation.InsertValue("this", cel::runtime::CelValue::CreateStringView("abc"));
+  activation.InsertValue("pattern", cel::runtime::CelValue::CreateStringView("a"));
+  auto result = expr_or.value()->Evaluate(activation, &arena);
+  ASSERT_TRUE(result.ok()) << result.status();
+  ASSERT_TRUE(result.value().IsBool());
+  EXPECT_TRUE(result.value().BoolOrDie());
+
+  activation.RemoveValueEntry("pattern");
+  activation.InsertValue(
+      "pattern", cel::runtime::CelValue::CreateStringView("^(foo|bar|baz)+[0-9]{2,8}$"));
+  result = expr_or.value()->Evaluate(activation, &arena);
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_TRUE(result.value().IsError());
+}
+
+} // namespace
+} // namespace buf::validate::internal
@@ -0,0 +1,437 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/rule_compiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+
+namespace buf::validate::internal {
+namespace {
+
+// Snapshot layout, with all integers stored as 32-bit little endian:
+//
+//   magic "PVEX" | version | count | count * (expression size | expression | AST size | AST)
+//
+// where AST is a serialized cel.expr.ParsedExpr. Bump the version whenever the layout, or the
+// way expressions are parsed, changes.
+constexpr std::string_view kSnapshotMagic = "PVEX";
+constexpr uint32_t kSnapshotVersion = 1;
+
+void appendUint32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+  }
+}
+
+void appendBytes(std::string& out, std::string_view value) {
+  appendUint32(out, static_cast<uint32_t>(value.size()));
+  out.append(value);
+}
+
+bool readUint32(std::string_view& in, uint32_t& value) {
+  if (in.size() < 4) {
+    return false;
+  }
+  value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (i * 8);
+  }
+  in.remove_prefix(4);
+  return true;
+}
+
+bool readBytes(std::string_view& in, std::string_view& value) {
+  uint32_t size;
+  if (!readUint32(in, size) || in.size() < size) {
+    return false;
+  }
+  value = in.substr(0, size);
+  in.remove_prefix(size);
+  return true;
+}
+
+// Returns the CEL constant for a singular scalar field of message, or nullopt if the field is
+// not a singular scalar.
+absl::optional<::cel::expr::Constant> fieldConstant(
+    const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field) {
+  if (field == nullptr || field->is_repeated()) {
+    return absl::nullopt;
+  }
+  const auto* reflection = message.GetReflection();
+  ::cel::expr::Constant constant;
+  switch (field->cpp_type()) {
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+      constant.set_int64_value(reflection->GetInt32(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+      constant.set_int64_value(reflection->GetInt64(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+      constant.set_int64_value(reflection->GetEnumValue(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+      constant.set_uint64_value(reflection->GetUInt32(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+      constant.set_uint64_value(reflection->GetUInt64(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+      constant.set_double_value(reflection->GetFloat(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+      constant.set_double_value(reflection->GetDouble(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+      constant.set_bool_value(reflection->GetBool(message, field));
+      break;
+    case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+      if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES) {
+        constant.set_bytes_value(reflection->GetString(message, field));
+      } else {
+        constant.set_string_value(reflection->GetString(message, field));
+      }
+      break;
+    default:
+      return absl::nullopt;
+  }
+  return constant;
+}
+
+// Returns true if pred holds for expr or any of its subexpressions.
+template <typename Pred>
+bool anySubexpr(const ::cel::expr::Expr& expr, const Pred& pred) {
+  if (pred(expr)) {
+    return true;
+  }
+  switch (expr.expr_kind_case()) {
+    case ::cel::expr::Expr::kSelectExpr:
+      return anySubexpr(expr.select_expr().operand(), pred);
+    case ::cel::expr::Expr::kCallExpr:
+      if (expr.call_expr().has_target() && anySubexpr(expr.call_expr().target(), pred)) {
+        return true;
+      }
+      for (const auto& arg : expr.call_expr().args()) {
+        if (anySubexpr(arg, pred)) {
+          return true;
+        }
+      }
+      return false;
+    case ::cel::expr::Expr::kListExpr:
+      for (const auto& element : expr.list_expr().elements()) {
+        if (anySubexpr(element, pred)) {
+          return true;
+        }
+      }
+      return false;
+    case ::cel::expr::Expr::kStructExpr:
+      for (const auto& entry : expr.struct_expr().entries()) {
+        if ((entry.has_map_key() && anySubexpr(entry.map_key(), pred)) ||
+            anySubexpr(entry.value(), pred)) {
+          return true;
+        }
+      }
+      return false;
+    case ::cel::expr::Expr::kComprehensionExpr: {
+      const auto& comprehension = expr.comprehension_expr();
+      return anySubexpr(comprehension.iter_range(), pred) ||
+          anySubexpr(comprehension.accu_init(), pred) ||
+          anySubexpr(comprehension.loop_condition(), pred) ||
+          anySubexpr(comprehension.loop_step(), pred) || anySubexpr(comprehension.result(), pred);
+    }
+    default:
+      return false;
+  }
+}
+
+bool isRulesVariable(std::string_view name) { return name == "rules" || name == "rule"; }
+
+// Returns true if expr reads the `rules` or `rule` activation variables.
+bool referencesRules(const ::cel::expr::Expr& expr) {
+  return anySubexpr(expr, [](const ::cel::expr::Expr& subexpr) {
+    return subexpr.has_ident_expr() && isRulesVariable(subexpr.ident_expr().name());
+  });
+}
+
+// Returns true if a comprehension in expr declares a variable named `rules` or `rule`, which would
+// shadow the activation variables of the same name.
+bool shadowsRules(const ::cel::expr::Expr& expr) {
+  return anySubexpr(expr, [](const ::cel::expr::Expr& subexpr) {
+    return subexpr.has_comprehension_expr() &&
+        (isRulesVariable(subexpr.comprehension_expr().iter_var()) ||
+         isRulesVariable(subexpr.comprehension_expr().accu_var()));
+  });
+}
+
+// Replaces references to constant rule values in an expression with literals. Every replaced
+// constant is appended to key, so that residual programs are only shared between rules that bind
+// the same values.
+class ConstantBinder {
+ public:
+  ConstantBinder(
+      const google::protobuf::Message& rules, const google::protobuf::FieldDescriptor* ruleField)
+      : rules_(rules), ruleField_(ruleField) {}
+
+  void Bind(::cel::expr::Expr& expr) {
+    switch (expr.expr_kind_case()) {
+      case ::cel::expr::Expr::kIdentExpr:
+        if (expr.ident_expr().name() == "rule") {
+          replace(expr, fieldConstant(rules_, ruleField_));
+        }
+        return;
+      case ::cel::expr::Expr::kSelectExpr: {
+        auto& select = *expr.mutable_select_expr();
+        if (!select.test_only() && select.operand().has_ident_expr() &&
+            select.operand().ident_expr().name() == "rules") {
+          const auto* field = rules_.GetDescriptor()->FindFieldByName(select.field());
+          replace(expr, fieldConstant(rules_, field));
+          return;
+        }
+        Bind(*select.mutable_operand());
+        return;
+      }
+      case ::cel::expr::Expr::kCallExpr: {
+        auto& call = *expr.mutable_call_expr();
+        if (call.has_target()) {
+          Bind(*call.mutable_target());
+        }
+        for (auto& arg : *call.mutable_args()) {
+          Bind(arg);
+        }
+        return;
+      }
+      case ::cel::expr::Expr::kListExpr:
+        for (auto& element : *expr.mutable_list_expr()->mutable_elements()) {
+          Bind(element);
+        }
+        return;
+      case ::cel::expr::Expr::kStructExpr:
+        for (auto& entry : *expr.mutable_struct_expr()->mutable_entries()) {
+          if (entry.has_map_key()) {
+            Bind(*entry.mutable_map_key());
+          }
+          Bind(*entry.mutable_value());
+        }
+        return;
+      case ::cel::expr::Expr::kComprehensionExpr: {
+        auto& comprehension = *expr.mutable_comprehension_expr();
+        Bind(*comprehension.mutable_iter_range());
+        Bind(*comprehension.mutable_accu_init());
+        Bind(*comprehension.mutable_loop_condition());
+        Bind(*comprehension.mutable_loop_step());
+        Bind(*comprehension.mutable_result());
+        return;
+      }
+      default:
+        return;
+    }
+  }
+
+  [[nodiscard]] const std::string& key() const { return key_; }
+
+ private:
+  void replace(::cel::expr::Expr& expr, absl::optional<::cel::expr::Constant> constant) {
+    if (!constant.has_value()) {
+      return;
+    }
+    absl::StrAppend(&key_, expr.id(), "=", constant->SerializeAsString(), ";");
+    int64_t id = expr.id();
+    expr.Clear();
+    expr.set_id(id);
+    *expr.mutable_const_expr() = std::move(*constant);
+  }
+
+  const google::protobuf::Message& rules_;
+  const google::protobuf::FieldDescriptor* ruleField_;
+  std::string key_;
+};
+
+} // namespace
+
+absl::StatusOr<std::shared_ptr<const ::cel::expr::ParsedExpr>> ExpressionCache::Parse(
+    std::string_view expression) {
+  std::string_view encoded;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (auto iter = entries_.find(expression); iter != entries_.end()) {
+      if (iter->second.parsed != nullptr) {
+        return iter->second.parsed;
+      }
+      encoded = iter->second.encoded;
+    }
+  }
+  std::shared_ptr<const ::cel::expr::ParsedExpr> parsed;
+  if (encoded.data() != nullptr) {
+    // Decode outside of the lock, so that compiling threads decode different expressions in
+    // parallel. The snapshot data outlives the cache, so encoded stays valid.
+    auto decoded = std::make_shared<::cel::expr::ParsedExpr>();
+    if (decoded->ParseFromArray(encoded.data(), static_cast<int>(encoded.size()))) {
+      parsed = std::move(decoded);
+    }
+  }
+  if (parsed == nullptr) {
+    // Not in the cache, or a corrupt snapshot entry: parse the expression.
+    parseCount_.fetch_add(1, std::memory_order_relaxed);
+    auto pexpr_or = google::api::expr::parser::Parse(expression);
+    if (!pexpr_or.ok()) {
+      return pexpr_or.status();
+    }
+    parsed = std::make_shared<const ::cel::expr::ParsedExpr>(std::move(pexpr_or).value());
+  }
+  absl::MutexLock lock(&mutex_);
+  auto& entry = entries_.try_emplace(expression).first->second;
+  if (entry.parsed == nullptr) {
+    // Another thread may have published its copy first, in which case that one is shared.
+    entry.parsed = std::move(parsed);
+  }
+  return entry.parsed;
+}
+
+std::string ExpressionCache::SaveSnapshot() const {
+  absl::MutexLock lock(&mutex_);
+  // Sort by expression text so that snapshots are reproducible.
+  std::vector<const std::pair<const std::string, Entry>*> sorted;
+  sorted.reserve(entries_.size());
+  for (const auto& entry : entries_) {
+    sorted.push_back(&entry);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const auto* lhs, const auto* rhs) {
+    return lhs->first < rhs->first;
+  });
+  std::string snapshot(kSnapshotMagic);
+  appendUint32(snapshot, kSnapshotVersion);
+  appendUint32(snapshot, static_cast<uint32_t>(sorted.size()));
+  for (const auto* entry : sorted) {
+    appendBytes(snapshot, entry->first);
+    if (entry->second.parsed != nullptr) {
+      appendBytes(snapshot, entry->second.parsed->SerializeAsString());
+    } else {
+      appendBytes(snapshot, entry->second.encoded);
+    }
+  }
+  return snapshot;
+}
+
+absl::Status ExpressionCache::LoadSnapshot(std::string_view snapshot) {
+  if (snapshot.substr(0, kSnapshotMagic.size()) != kSnapshotMagic) {
+    return absl::InvalidArgumentError("not a rule expression snapshot");
+  }
+  snapshot.remove_prefix(kSnapshotMagic.size());
+  uint32_t version;
+  uint32_t count;
+  if (!readUint32(snapshot, version) || !readUint32(snapshot, count)) {
+    return absl::InvalidArgumentError("truncated rule expression snapshot");
+  }
+  if (version != kSnapshotVersion) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "unsupported rule expression snapshot version ",
+        version,
+        ", expected ",
+        kSnapshotVersion));
+  }
+  std::vector<std::pair<std::string_view, std::string_view>> loaded;
+  loaded.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    std::string_view expression;
+    std::string_view encoded;
+    if (!readBytes(snapshot, expression) || !readBytes(snapshot, encoded)) {
+      return absl::InvalidArgumentError("truncated rule expression snapshot");
+    }
+    loaded.emplace_back(expression, encoded);
+  }
+  absl::MutexLock lock(&mutex_);
+  for (const auto& [expression, encoded] : loaded) {
+    entries_.try_emplace(expression, Entry{encoded, nullptr});
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::shared_ptr<const google::api::expr::runtime::CelExpression>>
+RuleCompiler::Compile(
+    std::string_view expression,
+    const google::protobuf::Message* rules,
+    const google::protobuf::FieldDescriptor* ruleField) {
+  // Without rules to bind, the program only depends on the expression text, so the cache can be
+  // checked before parsing.
+  if (caches_ != nullptr && rules == nullptr) {
+    if (auto program = caches_->programs.Find(expression); program != nullptr) {
+      return program;
+    }
+  }
+  auto parsed_or = Parse(expression);
+  if (!parsed_or.ok()) {
+    return parsed_or.status();
+  }
+  auto parsed = std::move(parsed_or).value();
+  std::string key(expression);
+  if (rules != nullptr && referencesRules(parsed->expr()) && !shadowsRules(parsed->expr())) {
+    auto bound = std::make_shared<::cel::expr::ParsedExpr>(*parsed);
+    ConstantBinder binder(*rules, ruleField);
+    binder.Bind(*bound->mutable_expr());
+    if (!binder.key().empty()) {
+      absl::StrAppend(&key, "\n", binder.key());
+      parsed = std::move(bound);
+    }
+  }
+  if (caches_ != nullptr && rules != nullptr) {
+    if (auto program = caches_->programs.Find(key); program != nullptr) {
+      return program;
+    }
+  }
+  auto expr_or = builder_.CreateExpression(&parsed->expr(), &parsed->source_info());
+  if (!expr_or.ok()) {
+    return expr_or.status();
+  }
+  std::shared_ptr<const google::api::expr::runtime::CelExpression> program =
+      std::move(expr_or).value();
+  if (caches_ != nullptr) {
+    program = caches_->programs.Insert(key, std::move(program));
+  }
+  return program;
+}
+
+bool RuleCompiler::References(std::string_view expression, std::string_view variable) {
+  // Every reference spells out the name, so most expressions are ruled out without parsing.
+  if (!absl::StrContains(expression, variable)) {
+    return false;
+  }
+  auto parsed_or = Parse(expression);
+  if (!parsed_or.ok()) {
+    return true;
+  }
+  return anySubexpr(parsed_or.value()->expr(), [variable](const ::cel::expr::Expr& subexpr) {
+    return subexpr.has_ident_expr() && subexpr.ident_expr().name() == variable;
+  });
+}
+
+absl::StatusOr<std::shared_ptr<const ::cel::expr::ParsedExpr>> RuleCompiler::Parse(
+    std::string_view expression) {
+  if (caches_ != nullptr) {
+    return caches_->expressions.Parse(expression);
+  }
+  auto pexpr_or = google::api::expr::parser::Parse(expression);
+  if (!pexpr_or.ok()) {
+    return pexpr_or.status();
+  }
+  return std::make_shared<const ::cel::expr::ParsedExpr>(std::move(pexpr_or).value());
+}
+
+} // namespace buf::validate::internal
@@ -0,0 +1,163 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "eval/public/cel_expression.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "parser/parser.h"
+
+namespace buf::validate::internal {
+
+/// A thread-safe cache of parsed rule expressions, keyed by expression text.
+///
+/// The contents of the cache can be saved to a versioned binary snapshot, and loaded back into
+/// another cache, typically in another process, so that expressions it contains do not have to be
+/// parsed again.
+class ExpressionCache {
+ public:
+  ExpressionCache() = default;
+  ExpressionCache(const ExpressionCache&) = delete;
+  void operator=(const ExpressionCache&) = delete;
+
+  /// Returns the parsed form of expression, parsing it if it is not in the cache yet.
+  absl::StatusOr<std::shared_ptr<const ::cel::expr::ParsedExpr>> Parse(std::string_view expression);
+
+  /// Returns how many expressions the cache has parsed from their text, as opposed to decoding
+  /// them from a snapshot.
+  [[nodiscard]] size_t ParseCount() const { return parseCount_.load(std::memory_order_relaxed); }
+
+  /// Serializes every parsed expression in the cache into a snapshot.
+  [[nodiscard]] std::string SaveSnapshot() const;
+
+  /// Adds the expressions from a snapshot created by SaveSnapshot to the cache. Expressions are
+  /// decoded on first use, directly from the snapshot data, so the data (which may be a
+  /// memory-mapped file) must outlive the cache.
+  absl::Status LoadSnapshot(std::string_view snapshot);
+
+ private:
+  struct Entry {
+    // The serialized expression, if loaded from a snapshot and not yet decoded.
+    std::string_view encoded;
+    std::shared_ptr<const ::cel::expr::ParsedExpr> parsed;
+  };
+
+  mutable absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  std::atomic<size_t> parseCount_{0};
+};
+
+/// A thread-safe map from a string key to a shared, immutable value, used to share compilation
+/// results between every rule that would otherwise produce an identical copy.
+template <typename T>
+class SharedCache {
+ public:
+  SharedCache() = default;
+  SharedCache(const SharedCache&) = delete;
+  void operator=(const SharedCache&) = delete;
+
+  /// Returns the cached value for key, or nullptr if there is none.
+  std::shared_ptr<T> Find(std::string_view key) const {
+    absl::MutexLock lock(&mutex_);
+    if (auto iter = values_.find(key); iter != values_.end()) {
+      return iter->second;
+    }
+    return nullptr;
+  }
+
+  /// Caches value for key, unless another thread got there first. Returns the value that is in
+  /// the cache afterwards.
+  std::shared_ptr<T> Insert(std::string_view key, std::shared_ptr<T> value) {
+    absl::MutexLock lock(&mutex_);
+    return values_.try_emplace(key, std::move(value)).first->second;
+  }
+
+  [[nodiscard]] size_t size() const {
+    absl::MutexLock lock(&mutex_);
+    return values_.size();
+  }
+
+ private:
+  mutable absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, std::shared_ptr<T>> values_ ABSL_GUARDED_BY(mutex_);
+};
+
+struct CompiledRules;
+
+/// The caches shared by every RuleCompiler of a ValidatorFactory.
+struct CompilerCaches {
+  /// Parsed expressions, keyed by expression text.
+  ExpressionCache expressions;
+  /// Planned programs, keyed by expression text and the constants bound into them. Rule
+  /// expressions only depend on the field they validate through the `this`, `rules` and `rule`
+  /// activation variables, so a single program can be shared by every rule with the same key.
+  /// Programs refer to functions in the registry of the builder that planned them, so that
+  /// builder must outlive the cache.
+  SharedCache<const google::api::expr::runtime::CelExpression> programs;
+  /// Compiled field rule sets, keyed by field type and serialized FieldRules. Entries must not be
+  /// modified once they are in the cache.
+  SharedCache<CompiledRules> ruleSets;
+};
+
+/// Compiles rule expressions into CEL programs.
+///
+/// A RuleCompiler is used by a single thread at a time, for the duration of one compilation, but
+/// the caches it refers to may be shared with other compilers.
+class RuleCompiler {
+ public:
+  explicit RuleCompiler(
+      google::api::expr::runtime::CelExpressionBuilder& builder, CompilerCaches* caches = nullptr)
+      : builder_(builder), caches_(caches) {}
+
+  /// Parses and plans the given expression, or returns the program already planned for it.
+  ///
+  /// If rules is given, the expression is partially evaluated against it before planning: each
+  /// selection of a singular scalar field of the `rules` variable, and the `rule` variable itself
+  /// if ruleField is a singular scalar field, is replaced by its constant value. Constant folding
+  /// and regex precompilation then apply to the residual program, which is only shared with rules
+  /// that bind the same constants. A bound pattern that is not a valid regex therefore makes
+  /// Compile fail, instead of failing each evaluation of the program.
+  absl::StatusOr<std::shared_ptr<const google::api::expr::runtime::CelExpression>> Compile(
+      std::string_view expression,
+      const google::protobuf::Message* rules = nullptr,
+      const google::protobuf::FieldDescriptor* ruleField = nullptr);
+
+  /// Returns true if expression may read the activation variable with the given name. Comprehension
+  /// variables of the same name are counted as references too.
+  bool References(std::string_view expression, std::string_view variable);
+
+  [[nodiscard]] google::api::expr::runtime::CelExpressionBuilder& builder() { return builder_; }
+
+  /// Returns the shared caches, or nullptr if this compiler does not use any.
+  [[nodiscard]] CompilerCaches* caches() { return caches_; }
+
+ private:
+  google::api::expr::runtime::CelExpressionBuilder& builder_;
+  CompilerCaches* caches_;
+
+  absl::StatusOr<std::shared_ptr<const ::cel::expr::ParsedExpr>> Parse(
+      std::string_view expression);
+};
+
+} // namespace buf::validate::internal
@@ -0,0 +1,194 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/rule_compiler.h"
+
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "buf/validate/internal/rules.h"
+#include "buf/validate/validate.pb.h"
+#include "eval/public/activation.h"
+#include "google/protobuf/arena.h"
+#include "gtest/gtest.h"
+
+namespace buf::validate::internal {
+namespace {
+
+TEST(ExpressionCacheTest, ParseCaches) {
+  ExpressionCache cache;
+  auto first = cache.Parse("this > 1");
+  ASSERT_TRUE(first.ok()) << first.status();
+  auto second = cache.Parse("this > 1");
+  ASSERT_TRUE(second.ok()) << second.status();
+  EXPECT_EQ(first.value(), second.value());
+  EXPECT_FALSE(cache.Parse("this >").ok());
+}
+
+TEST(ExpressionCacheTest, SnapshotRoundTrip) {
+  ExpressionCache cache;
+  ASSERT_TRUE(cache.Parse("this > 1").ok());
+  ASSERT_TRUE(cache.Parse("size(this) < 5").ok());
+  std::string snapshot = cache.SaveSnapshot();
+
+  ExpressionCache loaded;
+  ASSERT_TRUE(loaded.LoadSnapshot(snapshot).ok());
+  EXPECT_EQ(loaded.SaveSnapshot(), snapshot);
+  auto parsed = loaded.Parse("this > 1");
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  EXPECT_EQ(
+      parsed.value()->SerializeAsString(), cache.Parse("this > 1").value()->SerializeAsString());
+  EXPECT_EQ(cache.ParseCount(), 2);
+  EXPECT_EQ(loaded.ParseCount(), 0);
+}
+
+TEST(ExpressionCacheTest, ConcurrentSnapshotDecode) {
+  ExpressionCache cache;
+  ASSERT_TRUE(cache.Parse("this > 1").ok());
+  ExpressionCache loaded;
+  ASSERT_TRUE(loaded.LoadSnapshot(cache.SaveSnapshot()).ok());
+
+  // Every reader decodes outside the lock, but all of them get the one published copy.
+  std::vector<const ::cel::expr::ParsedExpr*> parsed(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < parsed.size(); i++) {
+    threads.emplace_back([&, i]() {
+      auto result = loaded.Parse("this > 1");
+      parsed[i] = result.ok() ? result.value().get() : nullptr;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_NE(parsed[0], nullptr);
+  for (const auto* expr : parsed) {
+    EXPECT_EQ(expr, parsed[0]);
+  }
+}
+
+TEST(ExpressionCacheTest, LoadInvalidSnapshot) {
+  ExpressionCache cache;
+  EXPECT_EQ(cache.LoadSnapshot("nope").code(), absl::StatusCode::kInvalidArgument);
+  std::string snapshot = cache.SaveSnapshot();
+  EXPECT_EQ(
+      cache.LoadSnapshot(snapshot.substr(0, snapshot.size() - 1)).code(),
+      absl::StatusCode::kInvalidArgument);
+  snapshot[4] = 2;
+  EXPECT_EQ(cache.LoadSnapshot(snapshot).code(), absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(RuleCompilerTest, SharesPrograms) {
+  google::protobuf::Arena arena;
+  auto builder_or = NewRuleBuilder(&arena);
+  ASSERT_TRUE(builder_or.ok()) << builder_or.status();
+  CompilerCaches caches;
+  RuleCompiler compiler(*builder_or.value(), &caches);
+  auto first = compiler.Compile("this > rules.gt");
+  ASSERT_TRUE(first.ok()) << first.status();
+  auto second = compiler.Compile("this > rules.gt");
+  ASSERT_TRUE(second.ok()) << second.status();
+  EXPECT_EQ(first.value(), second.value());
+  auto other = compiler.Compile("this < rules.lt");
+  ASSERT_TRUE(other.ok()) << other.status();
+  EXPECT_NE(first.value(), other.value());
+  EXPECT_EQ(caches.programs.size(), 2);
+  EXPECT_FALSE(compiler.Compile("this >").ok());
+  EXPECT_EQ(caches.programs.size(), 2);
+}
+
+TEST(RuleCompilerTest, BindsRuleConstants) {
+  google::protobuf::Arena arena;
+  auto builder_or = NewRuleBuilder(&arena);
+  ASSERT_TRUE(builder_or.ok()) << builder_or.status();
+  CompilerCaches caches;
+  RuleCompiler compiler(*builder_or.value(), &caches);
+  StringRules rules;
+  rules.set_min_len(3);
+  const auto* minLen = rules.GetDescriptor()->FindFieldByName("min_len");
+  auto first = compiler.Compile("uint(this.size()) < rules.min_len", &rules, minLen);
+  ASSERT_TRUE(first.ok()) << first.status();
+  auto second = compiler.Compile("uint(this.size()) < rule", &rules, minLen);
+  ASSERT_TRUE(second.ok()) << second.status();
+  auto same = compiler.Compile("uint(this.size()) < rules.min_len", &rules, minLen);
+  ASSERT_TRUE(same.ok()) << same.status();
+  EXPECT_EQ(first.value(), same.value());
+  rules.set_min_len(4);
+  auto other = compiler.Compile("uint(this.size()) < rules.min_len", &rules, minLen);
+  ASSERT_TRUE(other.ok()) << other.status();
+  EXPECT_NE(first.value(), other.value());
+
+  // The bound programs no longer read the rules variables.
+  google::api::expr::runtime::Activation activation;
+  activation.InsertValue("this", google::api::expr::runtime::CelValue::CreateStringView("ab"));
+  for (const auto& program : {first.value(), second.value()}) {
+    auto result = program->Evaluate(activation, &arena);
+    ASSERT_TRUE(result.ok()) << result.status();
+    ASSERT_TRUE(result.value().IsBool());
+    EXPECT_TRUE(result.value().BoolOrDie());
+  }
+}
+
+TEST(RuleCompilerTest, BindsOnlyRuleReferences) {
+  google::protobuf::Arena arena;
+  auto builder_or = NewRuleBuilder(&arena);
+  ASSERT_TRUE(builder_or.ok()) << builder_or.status();
+  CompilerCaches caches;
+  RuleCompiler compiler(*builder_or.value(), &caches);
+  StringRules rules;
+  rules.set_min_len(3);
+  // Mentions "rule" only in text, so there is nothing to bind, and the program is shared with
+  // the unbound one.
+  auto first = compiler.Compile("this != 'rules' && size(this) > 0", &rules);
+  ASSERT_TRUE(first.ok()) << first.status();
+  rules.set_min_len(4);
+  auto second = compiler.Compile("this != 'rules' && size(this) > 0", &rules);
+  ASSERT_TRUE(second.ok()) << second.status();
+  EXPECT_EQ(first.value(), second.value());
+  auto unbound = compiler.Compile("this != 'rules' && size(this) > 0");
+  ASSERT_TRUE(unbound.ok()) << unbound.status();
+  EXPECT_EQ(first.value(), unbound.value());
+  EXPECT_EQ(caches.programs.size(), 1);
+}
+
+TEST(RuleCompilerTest, References) {
+  google::protobuf::Arena arena;
+  auto builder_or = NewRuleBuilder(&arena);
+  ASSERT_TRUE(builder_or.ok()) << builder_or.status();
+  RuleCompiler compiler(*builder_or.value());
+  EXPECT_TRUE(compiler.References("this < now", "now"));
+  EXPECT_TRUE(compiler.References("[1].all(x, this + duration('1s') > now)", "now"));
+  EXPECT_FALSE(compiler.References("this > rules.gt", "now"));
+  EXPECT_FALSE(compiler.References("this != 'now' && this.known", "now"));
+}
+
+TEST(RuleCompilerTest, BoundPatternFailsToCompile) {
+  google::protobuf::Arena arena;
+  auto builder_or = NewRuleBuilder(&arena);
+  ASSERT_TRUE(builder_or.ok()) << builder_or.status();
+  RuleCompiler compiler(*builder_or.value());
+  StringRules rules;
+  rules.set_pattern("^a+$");
+  constexpr std::string_view expression = "!this.matches(rules.pattern) ? 'no match' : ''";
+  EXPECT_TRUE(compiler.Compile(expression, &rules).ok());
+  // The pattern is bound and precompiled, so an invalid one fails when the rules are compiled,
+  // rather than when a field is validated.
+  rules.set_pattern("[");
+  EXPECT_FALSE(compiler.Compile(expression, &rules).ok());
+  EXPECT_TRUE(compiler.Compile(expression).ok());
+}
+
+} // namespace
+} // namespace buf::validate::internal
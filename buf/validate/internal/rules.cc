@@ -53,7 +53,7 @@ bool isEmptyItem(cel::runtime::CelValue item) {
 } // namespace
 
 absl::StatusOr<std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder>> NewRuleBuilder(
-    google::protobuf::Arena* arena) {
+    google::protobuf::Arena* arena, RegexCache* regexCache, bool programOwnedConstants) {
   cel::runtime::InterpreterOptions options;
   options.enable_qualified_type_identifiers = true;
   options.enable_timestamp_duration_overflow_errors = true;
@@ -61,7 +61,10 @@ absl::StatusOr<std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder>
   options.enable_empty_wrapper_null_unboxing = true;
   options.enable_regex_precompilation = true;
   options.constant_folding = true;
-  options.constant_arena = arena;
+  // Without an arena, folded constants are owned by the program they were folded into.
+  options.constant_arena = programOwnedConstants ? nullptr : arena;
+  // Patterns that are not constant are compiled through the cache instead of on every call.
+  options.enable_regex = regexCache == nullptr;
 
   std::unique_ptr<cel::runtime::CelExpressionBuilder> builder =
       cel::runtime::CreateCelExpressionBuilder(options);
@@ -77,6 +80,13 @@ absl::StatusOr<std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder>
   if (!register_status.ok()) {
     return register_status;
   }
+  if (regexCache != nullptr) {
+    register_status = RegisterCachedRegexFuncs(
+        *builder->GetRegistry(), *regexCache, options.regex_max_program_size);
+    if (!register_status.ok()) {
+      return register_status;
+    }
+  }
   return builder;
 }
 
@@ -91,7 +101,6 @@ absl::Status FieldValidationRules::Validate(
     RuleContext& ctx, const google::protobuf::Message& message) const {
   static const google::protobuf::FieldDescriptor* requiredField =
       FieldRules::descriptor()->FindFieldByNumber(FieldRules::kRequiredFieldNumber);
-  google::api::expr::runtime::Activation activation;
   cel::runtime::CelValue result;
   std::string subPath;
   if (field_->is_map()) {
@@ -170,9 +179,8 @@ absl::Status FieldValidationRules::Validate(
     }
 
   }
-  activation.InsertValue("this", result);
   int pos = ctx.violations.size();
-  auto status = ValidateCel(ctx, activation);
+  auto status = ValidateCel(ctx, result);
   if (!status.ok()) {
     return status;
   }
@@ -193,7 +201,7 @@ absl::Status EnumValidationRules::Validate(
   }
   if (definedOnly_) {
     auto value = message.GetReflection()->GetEnumValue(message, field_);
-    if (field_->enum_type()->FindValueByNumber(value) == nullptr) {
+    if (!definedValues_.contains(value)) {
       Violation violation;
       *violation.mutable_rule_id() = "enum.defined_only";
       *violation.mutable_message() = "value must be one of the defined enum values";
@@ -217,6 +225,40 @@ absl::Status RepeatedValidationRules::Validate(
   if (ctx.shouldReturn(status) || itemRules_ == nullptr) {
     return status;
   }
+  if (enumItemSets_.has_value()) {
+    // Check the raw enum values against the sets of the rules directly, in one pass. Only if an
+    // item does not pass is every item validated below, to report its violations.
+    const bool ignoreEmpty = itemRules_->getIgnoreEmpty();
+    bool passes = true;
+    for (int32_t value : message.GetReflection()->GetRepeatedFieldRef<int32_t>(message, field_)) {
+      if (value == 0 && ignoreEmpty) {
+        continue;
+      }
+      for (const auto& [set, negated] : *enumItemSets_) {
+        passes = passes && set->contains(value) != negated;
+      }
+      if (!passes) {
+        break;
+      }
+    }
+    if (passes) {
+      return status;
+    }
+  } else if (field_->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_ENUM &&
+             itemRules_->getAnyRules() == nullptr && itemRules_->NativeOnly()) {
+    // Other native rules, such as const, are checked through their generic interface.
+    const auto* reflection = message.GetReflection();
+    int size = reflection->FieldSize(message, field_);
+    bool passes = true;
+    for (int i = 0; i < size && passes; i++) {
+      int value = reflection->GetRepeatedEnumValue(message, field_, i);
+      passes = (value == 0 && itemRules_->getIgnoreEmpty()) ||
+          itemRules_->PassesNative(cel::runtime::CelValue::CreateInt64(value));
+    }
+    if (passes) {
+      return status;
+    }
+  }
   // Validate each item.
   auto& list = *google::protobuf::Arena::Create<cel::runtime::FieldBackedListImpl>(
       ctx.arena, &message, field_, ctx.arena);
@@ -225,10 +267,8 @@ absl::Status RepeatedValidationRules::Validate(
     if (itemRules_->getIgnoreEmpty() && isEmptyItem(item)) {
       continue;
     }
-    cel::runtime::Activation activation;
-    activation.InsertValue("this", item);
     int pos = ctx.violations.size();
-    status = itemRules_->ValidateCel(ctx, activation);
+    status = itemRules_->ValidateCel(ctx, item);
     if (itemRules_->getAnyRules() != nullptr) {
       const auto& anyMsg = message.GetReflection()->GetRepeatedMessage(message, field_, i);
       status = itemRules_->ValidateAny(ctx, ProtoField{&message, field_, i}, anyMsg);
@@ -261,7 +301,6 @@ absl::Status MapValidationRules::Validate(
     return status;
   }
   cel::runtime::FieldBackedMapImpl mapVal(&message, field_, ctx.arena);
-  cel::runtime::Activation activation;
   const auto* keyField = field_->message_type()->FindFieldByName("key");
   const auto* valueField = field_->message_type()->FindFieldByName("value");
   auto keys_or = mapVal.ListKeys();
@@ -275,8 +314,7 @@ absl::Status MapValidationRules::Validate(
     auto key = keys[i];
     if (keyRules_ != nullptr) {
       if (!keyRules_->getIgnoreEmpty() || !isEmptyItem(key)) {
-        activation.InsertValue("this", key);
-        status = keyRules_->ValidateCel(ctx, activation);
+        status = keyRules_->ValidateCel(ctx, key);
         if (!status.ok()) {
           return status;
         }
@@ -292,15 +330,13 @@ absl::Status MapValidationRules::Validate(
           ctx.setFieldValue(ProtoField{&elemMsg, keyField}, pos);
           ctx.setForKey(pos);
         }
-        activation.RemoveValueEntry("this");
       }
     }
     if (valueRules_ != nullptr) {
       auto value = *mapVal[key];
       if (!valueRules_->getIgnoreEmpty() || !isEmptyItem(value)) {
-        activation.InsertValue("this", value);
         int valuePos = ctx.violations.size();
-        status = valueRules_->ValidateCel(ctx, activation);
+        status = valueRules_->ValidateCel(ctx, value);
         if (!status.ok()) {
           return status;
         }
@@ -315,7 +351,6 @@ absl::Status MapValidationRules::Validate(
               valuePos);
           ctx.setFieldValue(ProtoField{&elemMsg, valueField}, pos);
         }
-        activation.RemoveValueEntry("this");
       }
     }
     if (ctx.violations.size() > pos) {
@@ -345,16 +380,9 @@ absl::Status FieldValidationRules::ValidateAny(
     return absl::InvalidArgumentError("expected Any");
   }
   const auto& typeUri = anyMsg.GetReflection()->GetString(anyMsg, typeUriField);
-  if (anyRules_->in_size() > 0) {
+  if (!anyIn_.empty()) {
     // Must be in the list of allowed types.
-    bool found = false;
-    for (const auto& allowed : anyRules_->in()) {
-      if (allowed == typeUri) {
-        found = true;
-        break;
-      }
-    }
-    if (!found) {
+    if (!anyIn_.contains(typeUri)) {
       Violation violation;
       *violation.mutable_rule_id() = "any.in";
       *violation.mutable_message() = "type URL must be in the allow list";
@@ -370,23 +398,19 @@ absl::Status FieldValidationRules::ValidateAny(
           std::move(violation), field, ProtoField{&fieldRules_.any(), anyInField});
     }
   }
-  for (const auto& block : anyRules_->not_in()) {
-    if (block == typeUri) {
-      Violation violation;
-      *violation.mutable_rule_id() = "any.not_in";
-      *violation.mutable_message() = "type URL must not be in the block list";
-      if (field.index() == -1) {
-        *violation.mutable_field()->mutable_elements()->Add() =
-            fieldPathElement(field.descriptor());
-      }
-      *violation.mutable_rule()->mutable_elements()->Add() =
-          staticFieldPathElement<AnyRules, AnyRules::kNotInFieldNumber>();
-      *violation.mutable_rule()->mutable_elements()->Add() =
-          staticFieldPathElement<FieldRules, FieldRules::kAnyFieldNumber>();
-      ctx.violations.emplace_back(
-          std::move(violation), field, ProtoField{&fieldRules_.any(), anyNotInField});
-      break;
+  if (anyNotIn_.contains(typeUri)) {
+    Violation violation;
+    *violation.mutable_rule_id() = "any.not_in";
+    *violation.mutable_message() = "type URL must not be in the block list";
+    if (field.index() == -1) {
+      *violation.mutable_field()->mutable_elements()->Add() = fieldPathElement(field.descriptor());
     }
+    *violation.mutable_rule()->mutable_elements()->Add() =
+        staticFieldPathElement<AnyRules, AnyRules::kNotInFieldNumber>();
+    *violation.mutable_rule()->mutable_elements()->Add() =
+        staticFieldPathElement<FieldRules, FieldRules::kAnyFieldNumber>();
+    ctx.violations.emplace_back(
+        std::move(violation), field, ProtoField{&fieldRules_.any(), anyNotInField});
   }
   return absl::OkStatus();
 }
@@ -14,11 +14,16 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
+#include "absl/container/flat_hash_set.h"
 #include "buf/validate/internal/cel_validation_rules.h"
+#include "buf/validate/internal/native_rules.h"
+#include "buf/validate/internal/regex_cache.h"
 #include "buf/validate/validate.pb.h"
 #include "google/protobuf/arena.h"
 #include "google/protobuf/descriptor.h"
@@ -31,6 +36,8 @@ class MessageValidationRules final : public CelValidationRules {
   MessageValidationRules() = default;
 
   absl::Status Validate(RuleContext& ctx, const google::protobuf::Message& message) const override;
+
+  [[nodiscard]] size_t SpaceUsed() const override { return sizeof(*this) + CompiledSpaceUsed(); }
 };
 
 class FieldValidationRules : public CelValidationRules {
@@ -46,10 +53,20 @@ class FieldValidationRules : public CelValidationRules {
             field.ignore() == IGNORE_IF_ZERO_VALUE ||
             (desc->has_presence() && !mapEntryField_)),
         required_(field.required()),
-        anyRules_(anyRules) {}
+        anyRules_(anyRules) {
+    if (anyRules_ != nullptr) {
+      anyIn_.insert(anyRules_->in().begin(), anyRules_->in().end());
+      anyNotIn_.insert(anyRules_->not_in().begin(), anyRules_->not_in().end());
+    }
+  }
 
   absl::Status Validate(RuleContext& ctx, const google::protobuf::Message& message) const override;
 
+  [[nodiscard]] size_t SpaceUsed() const override {
+    return sizeof(*this) + CompiledSpaceUsed() +
+        (anyIn_.capacity() + anyNotIn_.capacity()) * sizeof(std::string_view);
+  }
+
   absl::Status ValidateAny(
       RuleContext& ctx, const ProtoField& field, const google::protobuf::Message& anyMsg) const;
 
@@ -64,6 +81,9 @@ class FieldValidationRules : public CelValidationRules {
   bool ignoreEmpty_ = false;
   bool required_ = false;
   const AnyRules* anyRules_ = nullptr;
+  // The type URLs of anyRules_, which outlives the sets.
+  absl::flat_hash_set<std::string_view> anyIn_;
+  absl::flat_hash_set<std::string_view> anyNotIn_;
 };
 
 class EnumValidationRules : public FieldValidationRules {
@@ -71,12 +91,27 @@ class EnumValidationRules : public FieldValidationRules {
 
  public:
   EnumValidationRules(const google::protobuf::FieldDescriptor* desc, const FieldRules& field)
-      : Base(desc, field), definedOnly_(field.enum_().defined_only()) {}
+      : Base(desc, field), definedOnly_(field.enum_().defined_only()) {
+    if (definedOnly_) {
+      std::vector<int32_t> defined;
+      const auto* enumType = desc->enum_type();
+      defined.reserve(enumType->value_count());
+      for (int i = 0; i < enumType->value_count(); i++) {
+        defined.push_back(enumType->value(i)->number());
+      }
+      definedValues_ = IntSet(std::move(defined));
+    }
+  }
 
   absl::Status Validate(RuleContext& ctx, const google::protobuf::Message& message) const override;
 
+  [[nodiscard]] size_t SpaceUsed() const override {
+    return sizeof(*this) + CompiledSpaceUsed() + definedValues_.SpaceUsed();
+  }
+
  private:
   bool definedOnly_;
+  IntSet definedValues_;
 };
 
 class RepeatedValidationRules : public FieldValidationRules {
@@ -87,12 +122,25 @@ class RepeatedValidationRules : public FieldValidationRules {
       const google::protobuf::FieldDescriptor* desc,
       const FieldRules& field,
       std::unique_ptr<FieldValidationRules> itemRules)
-      : Base(desc, field), itemRules_(std::move(itemRules)) {}
+      : Base(desc, field), itemRules_(std::move(itemRules)) {
+    if (itemRules_ != nullptr && itemRules_->getAnyRules() == nullptr &&
+        desc->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_ENUM) {
+      enumItemSets_ = itemRules_->NativeIntSets();
+    }
+  }
 
   absl::Status Validate(RuleContext& ctx, const google::protobuf::Message& message) const override;
 
+  [[nodiscard]] size_t SpaceUsed() const override {
+    return sizeof(*this) + CompiledSpaceUsed() + (itemRules_ ? itemRules_->SpaceUsed() : 0) +
+        (enumItemSets_.has_value() ? enumItemSets_->capacity() * sizeof((*enumItemSets_)[0]) : 0);
+  }
+
  private:
   std::unique_ptr<FieldValidationRules> itemRules_;
+  // For enum items whose rules are all in or not_in rules, the sets of those rules, owned by
+  // itemRules_, and whether each is negated.
+  absl::optional<std::vector<std::pair<const IntSet*, bool>>> enumItemSets_;
 };
 
 class MapValidationRules : public FieldValidationRules {
@@ -108,6 +156,11 @@ class MapValidationRules : public FieldValidationRules {
 
   absl::Status Validate(RuleContext& ctx, const google::protobuf::Message& message) const override;
 
+  [[nodiscard]] size_t SpaceUsed() const override {
+    return sizeof(*this) + CompiledSpaceUsed() + (keyRules_ ? keyRules_->SpaceUsed() : 0) +
+        (valueRules_ ? valueRules_->SpaceUsed() : 0);
+  }
+
  private:
   std::unique_ptr<FieldValidationRules> keyRules_;
   std::unique_ptr<FieldValidationRules> valueRules_;
@@ -123,6 +176,8 @@ class OneofValidationRules : public ValidationRules {
 
   absl::Status Validate(RuleContext& ctx, const google::protobuf::Message& message) const override;
 
+  [[nodiscard]] size_t SpaceUsed() const override { return sizeof(*this); }
+
  private:
   const google::protobuf::OneofDescriptor* oneof_ = nullptr;
   bool required_ = false;
@@ -137,15 +192,25 @@ public:
 
   absl::Status Validate(RuleContext& ctx, const google::protobuf::Message& message) const override;
 
+  [[nodiscard]] size_t SpaceUsed() const override {
+    return sizeof(*this) + fields_.capacity() * sizeof(fields_[0]);
+  }
+
 private:
   const std::vector<const google::protobuf::FieldDescriptor*> fields_;
   bool required_ = false;
   std::string field_names_() const;
 };
 
-// Creates a new expression builder suitable for creating rules.
+// Creates a new expression builder suitable for creating rules. If regexCache is given, the
+// `matches` function compiles patterns through it, and it must outlive the builder. Constants
+// folded while planning are allocated on arena, which therefore grows with every program the
+// builder plans, unless programOwnedConstants is true, in which case each program owns its folded
+// constants and frees them along with it.
 absl::StatusOr<std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder>> NewRuleBuilder(
-    google::protobuf::Arena* arena);
+    google::protobuf::Arena* arena,
+    RegexCache* regexCache = nullptr,
+    bool programOwnedConstants = false);
 
 inline auto fieldPathElement(const google::protobuf::FieldDescriptor* fieldDescriptor)
     -> FieldPathElement {
@@ -48,7 +48,8 @@ class ExpressionTest : public testing::Test {
     rule.set_expression(std::move(expr));
     rule.set_message(std::move(message));
     rule.set_id(std::move(id));
-    return rules_->Add(*builder_, rule, absl::nullopt, nullptr);
+    RuleCompiler compiler(*builder_);
+    return rules_->Add(compiler, rule, absl::nullopt, nullptr);
   }
 
   absl::Status Validate(
@@ -0,0 +1,186 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/traversal_plan.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "buf/validate/validate.pb.h"
+
+namespace buf::validate::internal {
+namespace {
+
+// Returns true if desc itself may have rules. Message rules are only ever read from these
+// options. Set extensions are not known ahead of time, so types that can have any are assumed
+// to have rules too.
+bool mayHaveRules(const google::protobuf::Descriptor* desc) {
+  if (desc->options().HasExtension(buf::validate::message) || desc->extension_range_count() > 0) {
+    return true;
+  }
+  for (int i = 0; i < desc->field_count(); i++) {
+    if (desc->field(i)->options().HasExtension(buf::validate::field)) {
+      return true;
+    }
+  }
+  for (int i = 0; i < desc->oneof_decl_count(); i++) {
+    if (desc->oneof_decl(i)->options().HasExtension(buf::validate::oneof)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+bool RulesReachability::Reaches(const google::protobuf::Descriptor* desc) {
+  absl::MutexLock lock(&mutex_);
+  if (auto iter = reaches_.find(desc); iter != reaches_.end()) {
+    return iter->second;
+  }
+  ComputeLocked(desc);
+  return reaches_[desc];
+}
+
+void RulesReachability::ComputeLocked(const google::protobuf::Descriptor* root) {
+  // Tarjan's algorithm, iteratively: all types of a strongly connected component reach the same
+  // types, so each component reaches rules if any of its types may have rules, or any component
+  // it refers to reaches rules.
+  struct Node {
+    int index;
+    int lowlink;
+    bool onStack;
+    bool reaches;
+  };
+  absl::flat_hash_map<const google::protobuf::Descriptor*, Node> nodes;
+  std::vector<const google::protobuf::Descriptor*> stack;
+  // The types being visited, and the index of the next field to follow from each.
+  std::vector<std::pair<const google::protobuf::Descriptor*, int>> frames;
+  auto visit = [&](const google::protobuf::Descriptor* desc) {
+    int index = static_cast<int>(nodes.size());
+    nodes.emplace(desc, Node{index, index, true, mayHaveRules(desc)});
+    stack.push_back(desc);
+    frames.emplace_back(desc, 0);
+  };
+  visit(root);
+  while (!frames.empty()) {
+    const auto* desc = frames.back().first;
+    if (int next = frames.back().second++; next < desc->field_count()) {
+      const auto* field = desc->field(next);
+      if (field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+        continue;
+      }
+      const auto* child = field->message_type();
+      if (auto known = reaches_.find(child); known != reaches_.end()) {
+        nodes[desc].reaches |= known->second;
+      } else if (auto iter = nodes.find(child); iter == nodes.end()) {
+        visit(child);
+      } else if (iter->second.onStack) {
+        // In the same component; its reaches is combined when the component is popped.
+        auto childIndex = iter->second.index;
+        auto& node = nodes[desc];
+        node.lowlink = std::min(node.lowlink, childIndex);
+      }
+      continue;
+    }
+    frames.pop_back();
+    auto node = nodes[desc];
+    if (node.lowlink == node.index) {
+      // desc is the root of a component, which is complete: the types above it on the stack.
+      auto begin = stack.end();
+      do {
+        --begin;
+      } while (*begin != desc);
+      bool reaches = false;
+      for (auto iter = begin; iter != stack.end(); ++iter) {
+        reaches |= nodes[*iter].reaches;
+      }
+      for (auto iter = begin; iter != stack.end(); ++iter) {
+        nodes[*iter].onStack = false;
+        reaches_[*iter] = reaches;
+      }
+      stack.erase(begin, stack.end());
+      node.reaches = reaches;
+    }
+    if (!frames.empty()) {
+      auto& parent = nodes[frames.back().first];
+      parent.lowlink = std::min(parent.lowlink, node.lowlink);
+      parent.reaches |= node.reaches;
+    }
+  }
+}
+
+absl::optional<TraversalPlan::Field> PlanField(const google::protobuf::FieldDescriptor* field) {
+  if (field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+    return absl::nullopt;
+  }
+  if (field->options().HasExtension(validate::field)) {
+    const auto& fieldExt = field->options().GetExtension(validate::field);
+    if (fieldExt.ignore() == IGNORE_ALWAYS ||
+        (fieldExt.has_repeated() && (fieldExt.repeated().items().ignore() == IGNORE_ALWAYS)) ||
+        (fieldExt.has_map() && (fieldExt.map().values().ignore() == IGNORE_ALWAYS))) {
+      return absl::nullopt;
+    }
+  }
+  TraversalPlan::Field planned{field};
+  if (field->is_map()) {
+    const auto* mapEntryDesc = field->message_type();
+    planned.mapKey = mapEntryDesc->FindFieldByName("key");
+    planned.mapValue = mapEntryDesc->FindFieldByName("value");
+    if (planned.mapValue != nullptr &&
+        planned.mapValue->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+      return absl::nullopt;
+    }
+  }
+  return planned;
+}
+
+TraversalPlan NewTraversalPlan(
+    const google::protobuf::Descriptor* desc, RulesReachability* reachability) {
+  RulesReachability ownReachability;
+  if (reachability == nullptr) {
+    reachability = &ownReachability;
+  }
+  TraversalPlan plan;
+  for (int i = 0; i < desc->field_count(); i++) {
+    auto planned = PlanField(desc->field(i));
+    if (!planned.has_value()) {
+      continue;
+    }
+    if (!planned->field->is_map()) {
+      if (reachability->Reaches(planned->field->message_type())) {
+        plan.fields.push_back(*planned);
+      }
+    } else if (planned->mapKey == nullptr || planned->mapValue == nullptr) {
+      // Kept, so that validation reports the malformed entry type.
+      plan.fields.push_back(*planned);
+    } else if (reachability->Reaches(planned->mapValue->message_type())) {
+      plan.fields.push_back(*planned);
+    }
+  }
+  std::sort(plan.fields.begin(), plan.fields.end(), [](const auto& a, const auto& b) {
+    return a.field->number() < b.field->number();
+  });
+  if (desc->extension_range_count() > 0) {
+    plan.listFields = true;
+    plan.fieldIndex.assign(desc->field_count(), -1);
+    for (size_t i = 0; i < plan.fields.size(); i++) {
+      plan.fieldIndex[plan.fields[i].field->index()] = static_cast<int>(i);
+    }
+  }
+  return plan;
+}
+
+} // namespace buf::validate::internal
@@ -0,0 +1,86 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "google/protobuf/descriptor.h"
+
+namespace buf::validate::internal {
+
+/// The message-typed fields of a message type that validation descends into, worked out once
+/// from the descriptor instead of for every message visited.
+struct TraversalPlan {
+  struct Field {
+    const google::protobuf::FieldDescriptor* field = nullptr;
+    // The key and value fields of the entry type, if field is a map. They are null if the entry
+    // type is malformed.
+    const google::protobuf::FieldDescriptor* mapKey = nullptr;
+    const google::protobuf::FieldDescriptor* mapValue = nullptr;
+  };
+
+  /// The fields to descend into, in field number order, which is the order in which ListFields
+  /// reports them.
+  std::vector<Field> fields;
+
+  /// Whether the type has extension ranges. Which message-typed extensions are set is only known
+  /// from each message, so such types are traversed with ListFields, using fieldIndex to find the
+  /// plan of regular fields.
+  bool listFields = false;
+
+  /// For types with extension ranges, the index in fields of each regular field, by its index in
+  /// the containing type, or -1 if it is not descended into.
+  std::vector<int> fieldIndex;
+
+  [[nodiscard]] size_t SpaceUsed() const {
+    return fields.capacity() * sizeof(Field) + fieldIndex.capacity() * sizeof(int);
+  }
+};
+
+/// Remembers which message types may have rules themselves or reach types that may, so that
+/// planning every type of a schema visits each type once, rather than once per field that refers
+/// to it. Thread-safe.
+class RulesReachability {
+ public:
+  /// Returns true if desc, or any message type reachable from it through message-typed fields,
+  /// may have rules.
+  bool Reaches(const google::protobuf::Descriptor* desc);
+
+ private:
+  absl::Mutex mutex_;
+  absl::flat_hash_map<const google::protobuf::Descriptor*, bool> reaches_
+      ABSL_GUARDED_BY(mutex_);
+
+  // Computes reaches_ for every type reachable from root that is not known yet.
+  void ComputeLocked(const google::protobuf::Descriptor* root)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+};
+
+/// Returns how to descend into field, or nullopt if validation never has to: field is not a
+/// message, validation always ignores it, or it is a map whose values are not messages.
+absl::optional<TraversalPlan::Field> PlanField(const google::protobuf::FieldDescriptor* field);
+
+/// Builds the traversal plan of desc. Besides the fields PlanField rules out, fields are left out
+/// if no message type reachable from them has any rules, so that rule-free subtrees are never
+/// visited. Which types reach rules is looked up in reachability, which should be shared by every
+/// plan of a schema; if it is null, a reachability of its own is used.
+TraversalPlan NewTraversalPlan(
+    const google::protobuf::Descriptor* desc, RulesReachability* reachability = nullptr);
+
+} // namespace buf::validate::internal
@@ -0,0 +1,65 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buf/validate/internal/traversal_plan.h"
+
+#include "buf/validate/conformance/cases/messages.pb.h"
+#include "google/protobuf/struct.pb.h"
+#include "gtest/gtest.h"
+
+namespace buf::validate::internal {
+namespace {
+
+TEST(TraversalPlanTest, DescendsIntoFieldsWithRules) {
+  auto plan = NewTraversalPlan(conformance::cases::Message::descriptor());
+  ASSERT_EQ(plan.fields.size(), 1);
+  EXPECT_EQ(plan.fields[0].field->name(), "val");
+  EXPECT_FALSE(plan.listFields);
+
+  // Recursive types are planned like any other.
+  plan = NewTraversalPlan(conformance::cases::TestMsg::descriptor());
+  ASSERT_EQ(plan.fields.size(), 1);
+  EXPECT_EQ(plan.fields[0].field->name(), "nested");
+}
+
+TEST(TraversalPlanTest, SkipsIgnoredFields) {
+  auto plan = NewTraversalPlan(conformance::cases::MessageSkip::descriptor());
+  EXPECT_TRUE(plan.fields.empty());
+}
+
+TEST(TraversalPlanTest, SkipsSubtreesWithoutRules) {
+  EXPECT_TRUE(NewTraversalPlan(conformance::cases::MessageNone::descriptor()).fields.empty());
+  // Struct, Value and ListValue refer to each other through maps, lists and oneofs.
+  EXPECT_TRUE(NewTraversalPlan(google::protobuf::Struct::descriptor()).fields.empty());
+  EXPECT_TRUE(NewTraversalPlan(google::protobuf::Value::descriptor()).fields.empty());
+}
+
+TEST(TraversalPlanTest, SharedReachability) {
+  RulesReachability reachability;
+  EXPECT_TRUE(reachability.Reaches(conformance::cases::Message::descriptor()));
+  // Computed along with Message, and cached.
+  EXPECT_TRUE(reachability.Reaches(conformance::cases::TestMsg::descriptor()));
+  EXPECT_FALSE(reachability.Reaches(google::protobuf::Value::descriptor()));
+  EXPECT_FALSE(reachability.Reaches(google::protobuf::ListValue::descriptor()));
+  EXPECT_FALSE(reachability.Reaches(google::protobuf::Struct::descriptor()));
+
+  auto plan = NewTraversalPlan(conformance::cases::Message::descriptor(), &reachability);
+  ASSERT_EQ(plan.fields.size(), 1);
+  EXPECT_EQ(plan.fields[0].field->name(), "val");
+  EXPECT_TRUE(
+      NewTraversalPlan(google::protobuf::Struct::descriptor(), &reachability).fields.empty());
+}
+
+} // namespace
+} // namespace buf::validate::internal
@@ -16,6 +16,9 @@
 
 #include "absl/status/status.h"
 #include "absl/strings/escaping.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
 #include "buf/validate/internal/proto_field.h"
 #include "buf/validate/validate.pb.h"
 #include "eval/public/cel_value.h"
@@ -47,6 +50,15 @@ class RuleViolation {
   absl::optional<ProtoField> ruleValue_;
 };
 
+/// A source of the current time, used for the `now` variable of rule expressions. Implementations
+/// must be thread-safe, since a clock may be shared by every validator of a factory.
+class Clock {
+ public:
+  virtual ~Clock() = default;
+
+  [[nodiscard]] virtual absl::Time Now() const = 0;
+};
+
 struct RuleContext {
   RuleContext() : failFast(false), arena(nullptr) {}
   RuleContext(const RuleContext&) = delete;
@@ -55,6 +67,18 @@ struct RuleContext {
   bool failFast;
   google::protobuf::Arena* arena;
   std::vector<RuleViolation> violations;
+  // The clock `now` is read from, or nullptr to use the system clock.
+  const Clock* clock = nullptr;
+
+  /// Returns the time rules see as `now`. The clock is read at most once per context, so every
+  /// rule evaluated during one validation sees the same time, and validations that never use
+  /// `now` never read the clock.
+  [[nodiscard]] absl::Time now() {
+    if (!now_.has_value()) {
+      now_ = clock != nullptr ? clock->Now() : absl::Now();
+    }
+    return *now_;
+  }
 
   [[nodiscard]] bool shouldReturn(const absl::Status& status) const {
     return !status.ok() || (failFast && !violations.empty());
@@ -105,6 +129,9 @@ struct RuleContext {
       }
     }
   }
+
+ private:
+  absl::optional<absl::Time> now_;
 };
 
 class ValidationRules {
@@ -117,6 +144,10 @@ class ValidationRules {
 
   virtual absl::Status Validate(
       RuleContext& ctx, const google::protobuf::Message& message) const = 0;
+
+  // Returns an estimate of the memory owned by these rules, in bytes. State shared with other
+  // rules, such as planned programs and interned rule sets, is not included.
+  [[nodiscard]] virtual size_t SpaceUsed() const = 0;
 };
 
 inline std::string fieldPathString(const FieldPath& path) {
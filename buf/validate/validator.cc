@@ -14,99 +14,232 @@
 
 #include "buf/validate/validator.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/blocking_counter.h"
+
 namespace buf::validate {
+namespace {
 
-absl::Status Validator::ValidateMessage(
-    internal::RuleContext& ctx, const google::protobuf::Message& message) {
-  const auto* rules_or = factory_->GetMessageRules(message.GetDescriptor());
-  if (rules_or == nullptr) {
-    return absl::NotFoundError(
-        absl::StrCat("rules not loaded for message: ", message.GetDescriptor()->full_name()));
-  }
-  if (!rules_or->ok()) {
-    return rules_or->status();
+// Returns the given message types followed by their nested types and every type they reference,
+// without duplicates.
+std::vector<const google::protobuf::Descriptor*> CollectMessageTypes(
+    absl::Span<const google::protobuf::Descriptor* const> roots) {
+  std::vector<const google::protobuf::Descriptor*> types;
+  absl::flat_hash_set<const google::protobuf::Descriptor*> seen;
+  for (const auto* desc : roots) {
+    if (seen.insert(desc).second) {
+      types.push_back(desc);
+    }
   }
-  for (const auto& rule : rules_or->value()) {
-    auto status = rule->Validate(ctx, message);
-    if (ctx.shouldReturn(status)) {
-      return status;
+  for (size_t next = 0; next < types.size(); next++) {
+    const auto* desc = types[next];
+    for (int i = 0; i < desc->nested_type_count(); i++) {
+      if (seen.insert(desc->nested_type(i)).second) {
+        types.push_back(desc->nested_type(i));
+      }
+    }
+    for (int i = 0; i < desc->field_count(); i++) {
+      const auto* field = desc->field(i);
+      if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE &&
+          seen.insert(field->message_type()).second) {
+        types.push_back(field->message_type());
+      }
     }
   }
-  return ValidateFields(ctx, message);
+  return types;
 }
 
-absl::Status Validator::ValidateFields(
-    internal::RuleContext& ctx, const google::protobuf::Message& message) {
-  // Validate any set fields that are messages.
-  std::vector<const google::protobuf::FieldDescriptor*> fields;
-  message.GetReflection()->ListFields(message, &fields);
-  for (const auto& field : fields) {
-    if (field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+// Returns the message types declared in the given files that are in package or one of its
+// sub-packages, as CollectMessageTypes does. An empty package matches every file.
+std::vector<const google::protobuf::Descriptor*> CollectFileMessageTypes(
+    absl::Span<const google::protobuf::FileDescriptor* const> files, std::string_view package) {
+  std::vector<const google::protobuf::Descriptor*> roots;
+  for (const auto* file : files) {
+    if (!package.empty() && file->package() != package &&
+        !absl::StartsWith(file->package(), absl::StrCat(package, "."))) {
       continue;
     }
-    if (field->options().HasExtension(validate::field)) {
-      const auto& fieldExt = field->options().GetExtension(validate::field);
-      if (fieldExt.ignore() == IGNORE_ALWAYS ||
-          (fieldExt.has_repeated() && (fieldExt.repeated().items().ignore() == IGNORE_ALWAYS)) ||
-          (fieldExt.has_map() && (fieldExt.map().values().ignore() == IGNORE_ALWAYS))) {
-        continue;
-      }
+    for (int i = 0; i < file->message_type_count(); i++) {
+      roots.push_back(file->message_type(i));
     }
-    if (field->is_map()) {
-      const auto* mapEntryDesc = field->message_type();
-      const auto* keyField = mapEntryDesc->FindFieldByName("key");
-      const auto* valueField = mapEntryDesc->FindFieldByName("value");
-      if (keyField == nullptr || valueField == nullptr) {
-        return absl::InternalError("map entry missing key or value field");
-      }
-      if (valueField->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
-        continue;
-      }
-      int size = message.GetReflection()->FieldSize(message, field);
-      for (int i = 0; i < size; i++) {
-        const auto& elemMsg = message.GetReflection()->GetRepeatedMessage(message, field, i);
-        const auto& valueMsg = elemMsg.GetReflection()->GetMessage(elemMsg, valueField);
-        int pos = ctx.violations.size();
-        auto status = ValidateMessage(ctx, valueMsg);
-        if (pos < ctx.violations.size()) {
-          FieldPathElement element = internal::fieldPathElement(field);
-          if (auto status = internal::setPathElementMapKey(&element, elemMsg, keyField, valueField);
+  }
+  return CollectMessageTypes(roots);
+}
+
+// Returns true if rules compiled with either message factory are the same.
+bool sameMessageFactory(
+    const std::unique_ptr<internal::MessageFactory>& a,
+    const std::unique_ptr<internal::MessageFactory>& b) {
+  if (a == nullptr || b == nullptr) {
+    return a == b;
+  }
+  return a->messageFactory() == b->messageFactory() && a->descriptorPool() == b->descriptorPool();
+}
+
+// Returns the type of the messages that validation descends into through planned, or nullptr if
+// its map entry type is malformed.
+const google::protobuf::Descriptor* plannedType(const internal::TraversalPlan::Field& planned) {
+  if (!planned.field->is_map()) {
+    return planned.field->message_type();
+  }
+  if (planned.mapKey == nullptr || planned.mapValue == nullptr) {
+    return nullptr;
+  }
+  return planned.mapValue->message_type();
+}
+
+} // namespace
+
+absl::Status Validator::ValidateMessage(
+    internal::RuleContext& ctx, const google::protobuf::Message& message) {
+  // Messages are visited depth first, in the same order as a recursive traversal would, but
+  // over an explicit stack, so that deeply nested messages cannot exhaust the call stack.
+  stack_.clear();
+  Step root{&message};
+  if (linked_ != nullptr && message.GetDescriptor() == linked_->root) {
+    root.linked = &linked_->types.front();
+  }
+  stack_.push_back(root);
+  bool unwinding = false;
+  while (!stack_.empty()) {
+    Step step = stack_.back();
+    stack_.pop_back();
+    if (step.pos >= 0) {
+      // Field path elements are only built for subtrees that produced violations.
+      if (ctx.violations.size() > step.pos) {
+        FieldPathElement element = internal::fieldPathElement(step.field.field);
+        if (step.mapEntry != nullptr) {
+          if (auto status = internal::setPathElementMapKey(
+                  &element, *step.mapEntry, step.field.mapKey, step.field.mapValue);
               !status.ok()) {
             return status;
           }
-          ctx.appendFieldPathElement(element, pos);
-        }
-        if (ctx.shouldReturn(status)) {
-          return status;
+        } else if (step.index >= 0) {
+          element.set_index(step.index);
         }
+        ctx.appendFieldPathElement(element, step.pos);
       }
-    } else if (field->is_repeated()) {
-      int size = message.GetReflection()->FieldSize(message, field);
-      for (int i = 0; i < size; i++) {
-        int pos = ctx.violations.size();
-        const auto& subMsg = message.GetReflection()->GetRepeatedMessage(message, field, i);
-        auto status = ValidateMessage(ctx, subMsg);
-        if (pos < ctx.violations.size()) {
-          FieldPathElement element = internal::fieldPathElement(field);
-          element.set_index(i);
-          ctx.appendFieldPathElement(element, pos);
-        }
-        if (ctx.shouldReturn(status)) {
-          return status;
-        }
+      continue;
+    }
+    if (unwinding) {
+      continue;
+    }
+    auto status = VisitMessage(ctx, step);
+    if (!status.ok()) {
+      return status;
+    }
+    // Stop visiting messages, but still complete the field paths of the violations found so far.
+    unwinding = ctx.shouldReturn(status);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Validator::VisitMessage(internal::RuleContext& ctx, const Step& step) {
+  const auto& message = *step.message;
+  if (step.depth > factory_->maxDepth_) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "message nesting exceeds the maximum depth of ",
+        factory_->maxDepth_,
+        ": ",
+        message.GetDescriptor()->full_name()));
+  }
+  const internal::Rules* rules;
+  const internal::TraversalPlan* plan;
+  ValidatorFactory::RulesPin pin;
+  if (step.linked != nullptr) {
+    rules = step.linked->rules;
+    plan = step.linked->plan;
+  } else {
+    const auto* entry = factory_->GetMessageRules(message.GetDescriptor(), pin);
+    if (entry == nullptr) {
+      return absl::NotFoundError(
+          absl::StrCat("rules not loaded for message: ", message.GetDescriptor()->full_name()));
+    }
+    rules = &entry->rules;
+    plan = &entry->plan;
+  }
+  if (!rules->ok()) {
+    return rules->status();
+  }
+  if (step.field.field != nullptr) {
+    Step exit = step;
+    exit.pos = ctx.violations.size();
+    stack_.push_back(exit);
+  }
+  for (const auto& rule : rules->value()) {
+    auto status = rule->Validate(ctx, message);
+    if (ctx.shouldReturn(status)) {
+      return status;
+    }
+  }
+
+  // Push the fields in reverse, so that they are popped in order.
+  const size_t first = stack_.size();
+  if (!plan->listFields) {
+    for (size_t i = 0; i < plan->fields.size(); i++) {
+      const auto* linked = step.linked != nullptr ? step.linked->fields[i] : nullptr;
+      if (auto status = PushFields(message, plan->fields[i], linked, step.depth + 1);
+          !status.ok()) {
+        return status;
       }
-    } else {
-      const auto& subMsg = message.GetReflection()->GetMessage(message, field);
-      int pos = ctx.violations.size();
-      auto status = ValidateMessage(ctx, subMsg);
-      if (pos < ctx.violations.size()) {
-        ctx.appendFieldPathElement(internal::fieldPathElement(field), pos);
+    }
+  } else {
+    // Set extensions are only known from the message, so list every set field.
+    std::vector<const google::protobuf::FieldDescriptor*> fields;
+    message.GetReflection()->ListFields(message, &fields);
+    for (const auto* field : fields) {
+      absl::optional<internal::TraversalPlan::Field> planned;
+      const internal::LinkedType* linked = nullptr;
+      if (field->is_extension()) {
+        planned = internal::PlanField(field);
+      } else if (int index = plan->fieldIndex[field->index()]; index >= 0) {
+        planned = plan->fields[index];
+        linked = step.linked != nullptr ? step.linked->fields[index] : nullptr;
       }
-      if (ctx.shouldReturn(status)) {
-        return status;
+      if (planned.has_value()) {
+        if (auto status = PushFields(message, *planned, linked, step.depth + 1); !status.ok()) {
+          return status;
+        }
       }
     }
   }
+  std::reverse(stack_.begin() + first, stack_.end());
+  return absl::OkStatus();
+}
+
+absl::Status Validator::PushFields(
+    const google::protobuf::Message& message,
+    const internal::TraversalPlan::Field& planned,
+    const internal::LinkedType* linked,
+    int depth) {
+  const auto* field = planned.field;
+  const auto* reflection = message.GetReflection();
+  if (field->is_map()) {
+    int size = reflection->FieldSize(message, field);
+    if (size > 0 && (planned.mapKey == nullptr || planned.mapValue == nullptr)) {
+      return absl::InternalError("map entry missing key or value field");
+    }
+    for (int i = 0; i < size; i++) {
+      const auto& elemMsg = reflection->GetRepeatedMessage(message, field, i);
+      const auto& valueMsg = elemMsg.GetReflection()->GetMessage(elemMsg, planned.mapValue);
+      stack_.push_back(Step{&valueMsg, planned, -1, &elemMsg, depth, -1, linked});
+    }
+  } else if (field->is_repeated()) {
+    int size = reflection->FieldSize(message, field);
+    for (int i = 0; i < size; i++) {
+      const auto& subMsg = reflection->GetRepeatedMessage(message, field, i);
+      stack_.push_back(Step{&subMsg, planned, i, nullptr, depth, -1, linked});
+    }
+  } else if (reflection->HasField(message, field)) {
+    const auto& subMsg = reflection->GetMessage(message, field);
+    stack_.push_back(Step{&subMsg, planned, -1, nullptr, depth, -1, linked});
+  }
   return absl::OkStatus();
 }
 
@@ -114,6 +247,7 @@ absl::StatusOr<ValidationResult> Validator::Validate(const google::protobuf::Mes
   internal::RuleContext ctx;
   ctx.failFast = failFast_;
   ctx.arena = arena_;
+  ctx.clock = clock_ != nullptr ? clock_ : factory_->nowClock_.get();
   auto status = ValidateMessage(ctx, message);
   if (!status.ok()) {
     return status;
@@ -122,69 +256,514 @@ absl::StatusOr<ValidationResult> Validator::Validate(const google::protobuf::Mes
   return ValidationResult{std::move(ctx.violations)};
 }
 
-absl::StatusOr<std::unique_ptr<ValidatorFactory>> ValidatorFactory::New() {
-  std::unique_ptr<ValidatorFactory> result(new ValidatorFactory());
-  auto builder_or = internal::NewRuleBuilder(&result->arena_);
+ValidatorFactory::~ValidatorFactory() {
+  absl::MutexLock lock(&warmupMutex_);
+  for (auto& thread : warmupThreads_) {
+    thread.join();
+  }
+}
+
+absl::StatusOr<std::shared_ptr<CompiledRuleStore>> CompiledRuleStore::New() {
+  std::shared_ptr<CompiledRuleStore> result(new CompiledRuleStore());
+  auto builder_or = internal::NewRuleBuilder(&result->arena_, &result->regexCache_);
   if (!builder_or.ok()) {
     return builder_or.status();
   }
-  absl::MutexLock lock(&result->mutex_);
-  result->builder_ = std::move(builder_or).value();
+  result->ReleaseBuilder(std::move(builder_or).value());
   return result;
 }
 
-absl::Status ValidatorFactory::Add(const google::protobuf::Descriptor* desc) {
+absl::StatusOr<std::shared_ptr<CompiledRuleStore>> CompiledRuleStore::NewWithSharedBuilders() {
+  // Intentionally leaked, so that factories with static storage duration can use it. Only its
+  // builders are used, so it holds no cache that could grow.
+  static const auto* pool = [] {
+    std::shared_ptr<CompiledRuleStore> result(new CompiledRuleStore());
+    result->programOwnedConstants_ = true;
+    auto builder_or = result->AcquireBuilder();
+    if (!builder_or.ok()) {
+      return new absl::StatusOr<std::shared_ptr<CompiledRuleStore>>(builder_or.status());
+    }
+    result->ReleaseBuilder(std::move(builder_or).value());
+    return new absl::StatusOr<std::shared_ptr<CompiledRuleStore>>(std::move(result));
+  }();
+  if (!pool->ok()) {
+    return pool->status();
+  }
+  std::shared_ptr<CompiledRuleStore> result(new CompiledRuleStore());
+  result->builderSource_ = pool->value();
+  return result;
+}
+
+absl::StatusOr<std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder>>
+CompiledRuleStore::AcquireBuilder() {
+  if (builderSource_ != nullptr) {
+    return builderSource_->AcquireBuilder();
+  }
   {
-    absl::WriterMutexLock lock(&mutex_);
-    auto iter = rules_.find(desc);
-    if (iter != rules_.end()) {
-      return iter->second.status();
-    }
-    auto status = rules_
-                      .emplace(
-                          desc,
-                          internal::NewMessageRules(
-                              messageFactory_, allowUnknownFields_, &arena_, *builder_, desc))
-                      .first->second.status();
-    if (!status.ok()) {
-      return status;
+    absl::MutexLock lock(&builderMutex_);
+    if (!builders_.empty()) {
+      auto builder = std::move(builders_.back());
+      builders_.pop_back();
+      return builder;
     }
   }
+  return internal::NewRuleBuilder(&arena_, &regexCache_, programOwnedConstants_);
+}
+
+void CompiledRuleStore::ReleaseBuilder(
+    std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder> builder) {
+  if (builderSource_ != nullptr) {
+    builderSource_->ReleaseBuilder(std::move(builder));
+    return;
+  }
+  absl::MutexLock lock(&builderMutex_);
+  builders_.push_back(std::move(builder));
+}
 
-  // Add all message fields recursively.
-  for (int i = 0; i < desc->field_count(); i++) {
-    const google::protobuf::FieldDescriptor* field = desc->field(i);
-    if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
-      if (auto status = Add(field->message_type()); !status.ok()) {
-        return status;
+absl::StatusOr<std::unique_ptr<ValidatorFactory>> ValidatorFactory::New() {
+  auto store_or = CompiledRuleStore::NewWithSharedBuilders();
+  if (!store_or.ok()) {
+    return store_or.status();
+  }
+  return New(std::move(store_or).value());
+}
+
+absl::StatusOr<std::unique_ptr<ValidatorFactory>> ValidatorFactory::New(
+    std::shared_ptr<CompiledRuleStore> store) {
+  if (store == nullptr) {
+    return absl::InvalidArgumentError("store must not be null");
+  }
+  return std::unique_ptr<ValidatorFactory>(new ValidatorFactory(std::move(store)));
+}
+
+absl::Status ValidatorFactory::Add(const google::protobuf::Descriptor* desc) {
+  // Add all message fields recursively. Types that were already compiled are still descended
+  // into, so that a type loaded lazily before it was added gets its whole closure pinned.
+  std::vector<const google::protobuf::Descriptor*> pending{desc};
+  absl::flat_hash_set<const google::protobuf::Descriptor*> seen{desc};
+  while (!pending.empty()) {
+    const auto* type = pending.back();
+    pending.pop_back();
+    auto* entry = FindOrAddEntry(type, false);
+    if (const auto& rules = CompileEntry(*entry->current.load(std::memory_order_acquire), type);
+        !rules.ok()) {
+      return rules.status();
+    }
+    for (int i = 0; i < type->field_count(); i++) {
+      const google::protobuf::FieldDescriptor* field = type->field(i);
+      if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE &&
+          seen.insert(field->message_type()).second) {
+        pending.push_back(field->message_type());
       }
     }
   }
   return absl::OkStatus();
 }
 
-const internal::Rules* ValidatorFactory::GetMessageRules(const google::protobuf::Descriptor* desc) {
+ValidatorFactory::AddErrors ValidatorFactory::AddAll(
+    absl::Span<const google::protobuf::FileDescriptor* const> files,
+    std::string_view package,
+    const Executor& executor) {
+  auto types = CollectFileMessageTypes(files, package);
+
+  // Added types are never evicted, so their compiled rules stay in place.
+  std::vector<CompiledType*> entries;
+  entries.reserve(types.size());
+  for (const auto* desc : types) {
+    entries.push_back(FindOrAddEntry(desc, false)->current.load(std::memory_order_acquire));
+  }
+
+  // Each worker claims types one at a time, compiling them with a builder of its own.
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    auto builder_or = store_->AcquireBuilder();
+    auto* builder = builder_or.ok() ? builder_or.value().get() : nullptr;
+    for (size_t i = next++; i < types.size(); i = next++) {
+      CompileEntry(*entries[i], types[i], builder);
+    }
+    if (builder_or.ok()) {
+      store_->ReleaseBuilder(std::move(builder_or).value());
+    }
+  };
+  if (executor == nullptr || types.size() < 2) {
+    work();
+  } else {
+    size_t workers =
+        std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()), types.size());
+    absl::BlockingCounter done(static_cast<int>(workers));
+    for (size_t i = 0; i < workers; i++) {
+      executor([&] {
+        work();
+        done.DecrementCount();
+      });
+    }
+    done.Wait();
+  }
+
+  AddErrors errors;
+  for (size_t i = 0; i < types.size(); i++) {
+    if (!entries[i]->rules.ok()) {
+      errors.emplace(types[i], entries[i]->rules.status());
+    }
+  }
+  return errors;
+}
+
+std::vector<std::shared_future<absl::Status>> ValidatorFactory::Warmup(
+    absl::Span<const google::protobuf::Descriptor* const> types, const Executor& executor) {
+  struct Task {
+    const google::protobuf::Descriptor* desc;
+    CompiledType* entry;
+    std::promise<absl::Status> ready;
+  };
+  // Entries are created up front, so that a request for a type that is still queued or compiling
+  // finds its entry and waits for that type alone, even with lazy loading disabled.
+  auto tasks = std::make_shared<std::vector<Task>>();
+  for (const auto* desc : CollectMessageTypes(types)) {
+    tasks->push_back(
+        Task{desc, FindOrAddEntry(desc, false)->current.load(std::memory_order_acquire), {}});
+  }
+  absl::flat_hash_map<const google::protobuf::Descriptor*, std::shared_future<absl::Status>> ready;
+  for (auto& task : *tasks) {
+    ready.emplace(task.desc, task.ready.get_future().share());
+  }
+  std::vector<std::shared_future<absl::Status>> futures;
+  futures.reserve(types.size());
+  for (const auto* desc : types) {
+    futures.push_back(ready[desc]);
+  }
+  auto run = [this, tasks] {
+    auto builder_or = store_->AcquireBuilder();
+    auto* builder = builder_or.ok() ? builder_or.value().get() : nullptr;
+    for (auto& task : *tasks) {
+      task.ready.set_value(CompileEntry(*task.entry, task.desc, builder).status());
+    }
+    if (builder_or.ok()) {
+      store_->ReleaseBuilder(std::move(builder_or).value());
+    }
+  };
+  if (executor != nullptr) {
+    executor(std::move(run));
+  } else {
+    absl::MutexLock lock(&warmupMutex_);
+    warmupThreads_.emplace_back(std::move(run));
+  }
+  return futures;
+}
+
+absl::StatusOr<Validator> ValidatorFactory::NewValidatorFor(
+    const google::protobuf::Descriptor* desc, google::protobuf::Arena* arena, bool failFast) {
+  auto linked_or = Link(desc);
+  if (!linked_or.ok()) {
+    return linked_or.status();
+  }
+  Validator validator(this, arena, failFast);
+  validator.linked_ = std::move(linked_or).value();
+  return validator;
+}
+
+absl::StatusOr<std::shared_ptr<const internal::LinkedGraph>> ValidatorFactory::Link(
+    const google::protobuf::Descriptor* root) {
+  LinkedEntry* entry;
   {
-    absl::ReaderMutexLock lock(&mutex_);
-    auto iter = rules_.find(desc);
-    if (iter != rules_.end()) {
-      return &iter->second;
+    absl::MutexLock lock(&linkMutex_);
+    // node_hash_map keeps the address of each entry stable.
+    entry = &linked_[root];
+  }
+  absl::call_once(entry->once, [&] { entry->graph = LinkGraph(root); });
+  return entry->graph;
+}
+
+absl::StatusOr<std::shared_ptr<const internal::LinkedGraph>> ValidatorFactory::LinkGraph(
+    const google::protobuf::Descriptor* root) {
+  // Compile every type the plans descend into. Entries are added as with Add, so they are never
+  // evicted, and stay at the same address for the lifetime of the factory.
+  std::vector<const google::protobuf::Descriptor*> types{root};
+  std::vector<const CompiledType*> entries;
+  absl::flat_hash_map<const google::protobuf::Descriptor*, size_t> indices{{root, 0}};
+  for (size_t next = 0; next < types.size(); next++) {
+    const auto* desc = types[next];
+    auto* entry = FindOrAddEntry(desc, false)->current.load(std::memory_order_acquire);
+    if (const auto& rules = CompileEntry(*entry, desc); !rules.ok()) {
+      return rules.status();
+    }
+    entries.push_back(entry);
+    for (const auto& planned : entry->plan.fields) {
+      const auto* type = plannedType(planned);
+      if (type != nullptr && indices.try_emplace(type, types.size()).second) {
+        types.push_back(type);
+      }
+    }
+  }
+  auto graph = std::make_shared<internal::LinkedGraph>();
+  graph->root = root;
+  graph->types.resize(types.size());
+  for (size_t i = 0; i < types.size(); i++) {
+    auto& linked = graph->types[i];
+    linked.rules = &entries[i]->rules;
+    linked.plan = &entries[i]->plan;
+    linked.fields.reserve(linked.plan->fields.size());
+    for (const auto& planned : linked.plan->fields) {
+      const auto* type = plannedType(planned);
+      linked.fields.push_back(type == nullptr ? nullptr : &graph->types[indices[type]]);
+    }
+  }
+  return graph;
+}
+
+const ValidatorFactory::CompiledType* ValidatorFactory::GetMessageRules(
+    const google::protobuf::Descriptor* desc, RulesPin& pin) {
+  // Fast path: no locks, and without a memory budget, no atomic read-modify-writes.
+  auto* entry = index_.Find(desc);
+  if (entry == nullptr) {
+    entry = FindOrAddEntry(desc, true);
+    if (entry == nullptr) {
+      return nullptr;
+    }
+  }
+  if (memoryBudget_ == 0) {
+    auto* compiled = entry->current.load(std::memory_order_acquire);
+    CompileEntry(*compiled, desc);
+    return compiled;
+  }
+  // Pairs with EvictLocked: either the evictor sees this reader, or this reader sees the rules
+  // unpublished.
+  entry->readers.fetch_add(1, std::memory_order_seq_cst);
+  pin.entry_ = entry;
+  auto* compiled = entry->current.load(std::memory_order_seq_cst);
+  if (compiled == nullptr) {
+    // Evicted since it was last used.
+    if (FindOrAddEntry(desc, true) == nullptr) {
+      return nullptr;
+    }
+    compiled = entry->current.load(std::memory_order_seq_cst);
+  }
+  // Only write the flag when it changes, to keep the cache line shared between readers.
+  if (!entry->referenced.load(std::memory_order_relaxed)) {
+    entry->referenced.store(true, std::memory_order_relaxed);
+  }
+  bool compiledNow = false;
+  CompileEntry(*compiled, desc, nullptr, &compiledNow);
+  if (compiledNow) {
+    absl::WriterMutexLock lock(&mutex_);
+    if (entry->lazy && entry->current.load(std::memory_order_relaxed) == compiled) {
+      lazyBytes_ += compiled->bytes;
+      entry->counted = true;
+      EvictLocked();
+    }
+  }
+  return compiled;
+}
+
+void ValidatorFactory::Unpin(RulesEntry& entry) {
+  if (entry.readers.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+    delete entry.retired.exchange(nullptr, std::memory_order_acq_rel);
+  }
+}
+
+absl::flat_hash_map<const google::protobuf::Descriptor*, size_t> ValidatorFactory::MemoryUsage()
+    const {
+  absl::flat_hash_map<const google::protobuf::Descriptor*, size_t> usage;
+  absl::ReaderMutexLock lock(&mutex_);
+  for (const auto& [desc, entry] : rules_) {
+    const auto* compiled = entry.current.load(std::memory_order_acquire);
+    if (compiled != nullptr && compiled->compiled.load(std::memory_order_acquire)) {
+      usage.emplace(desc, compiled->bytes);
+    }
+  }
+  return usage;
+}
+
+void ValidatorFactory::EvictLocked() {
+  // Two passes give every entry a second chance, after which the hand has cleared all flags.
+  for (size_t steps = 0; lazyBytes_ > memoryBudget_ && steps < 2 * clock_.size();) {
+    if (clockHand_ >= clock_.size()) {
+      clockHand_ = 0;
+    }
+    const auto* desc = clock_[clockHand_];
+    auto& entry = rules_.find(desc)->second;
+    if (!entry.lazy) {
+      // Pinned since it was loaded.
+      clock_[clockHand_] = clock_.back();
+      clock_.pop_back();
+      continue;
+    }
+    // Entries whose previously evicted rules are still in use are kept until they are freed.
+    if (!entry.counted || entry.referenced.exchange(false, std::memory_order_relaxed) ||
+        entry.retired.load(std::memory_order_relaxed) != nullptr) {
+      clockHand_++;
+      steps++;
+      continue;
+    }
+    lazyBytes_ -= entry.owner->bytes;
+    entry.counted = false;
+    entry.current.store(nullptr, std::memory_order_seq_cst);
+    entry.retired.store(
+        new std::shared_ptr<CompiledType>(std::move(entry.owner)), std::memory_order_seq_cst);
+    if (entry.readers.load(std::memory_order_seq_cst) == 0) {
+      delete entry.retired.exchange(nullptr, std::memory_order_acq_rel);
     }
-    if (disableLazyLoading_) {
+    clock_[clockHand_] = clock_.back();
+    clock_.pop_back();
+  }
+}
+
+ValidatorFactory::RulesEntry* ValidatorFactory::FindOrAddEntry(
+    const google::protobuf::Descriptor* desc, bool lazy) {
+  absl::WriterMutexLock lock(&mutex_);
+  auto* entry = index_.Find(desc);
+  bool added = false;
+  if (entry == nullptr) {
+    if (lazy && disableLazyLoading_) {
       return nullptr;
     }
+    entry = &rules_[desc];
+    entry->lazy = lazy && memoryBudget_ > 0;
+    added = true;
+  } else if (!lazy && entry->lazy) {
+    // Explicitly added types are never evicted.
+    entry->lazy = false;
+    if (entry->counted) {
+      lazyBytes_ -= entry->owner->bytes;
+      entry->counted = false;
+    }
+  }
+  if (entry->owner == nullptr) {
+    // New, or evicted since it was last loaded.
+    entry->owner = std::make_shared<CompiledType>();
+    entry->current.store(entry->owner.get(), std::memory_order_seq_cst);
+    if (entry->lazy) {
+      clock_.push_back(desc);
+    }
+  }
+  if (added) {
+    // node_hash_map keeps the address of each entry stable, so the pointer published to index_
+    // remains valid for the lifetime of the factory.
+    index_.Insert(desc, entry);
+  }
+  return entry;
+}
+
+void ValidatorFactory::ShareUnchanged(
+    const ValidatorFactory& previous,
+    absl::Span<const google::protobuf::FileDescriptor* const> files) {
+  // Besides the descriptor, compiled rules only depend on the store and these settings.
+  if (previous.store_ != store_ || previous.allowUnknownFields_ != allowUnknownFields_ ||
+      !sameMessageFactory(previous.messageFactory_, messageFactory_)) {
+    return;
   }
+  auto types = CollectFileMessageTypes(files, "");
+  absl::ReaderMutexLock previousLock(&previous.mutex_);
   absl::WriterMutexLock lock(&mutex_);
-  auto iter = rules_.find(desc);
-  if (iter != rules_.end()) {
-    return &iter->second;
-  }
-  return &rules_
-              .emplace(
-                  desc,
-                  internal::NewMessageRules(
-                      messageFactory_, allowUnknownFields_, &arena_, *builder_, desc))
-              .first->second;
+  for (const auto* desc : types) {
+    auto iter = previous.rules_.find(desc);
+    if (iter == previous.rules_.end() || iter->second.owner == nullptr ||
+        !iter->second.owner->compiled.load(std::memory_order_acquire) ||
+        index_.Find(desc) != nullptr) {
+      continue;
+    }
+    auto& entry = rules_[desc];
+    entry.owner = iter->second.owner;
+    entry.current.store(entry.owner.get(), std::memory_order_seq_cst);
+    index_.Insert(desc, &entry);
+  }
+}
+
+const internal::Rules& ValidatorFactory::CompileEntry(
+    CompiledType& entry,
+    const google::protobuf::Descriptor* desc,
+    google::api::expr::runtime::CelExpressionBuilder* builder,
+    bool* compiled) {
+  // Once the entry is compiled, call_once is a single acquire load.
+  absl::call_once(entry.once, [&] {
+    store_->typeCompiles_.fetch_add(1, std::memory_order_relaxed);
+    if (builder != nullptr) {
+      internal::RuleCompiler compiler(*builder, &store_->caches_);
+      entry.rules = internal::NewMessageRules(
+          messageFactory_, allowUnknownFields_, &entry.arena, compiler, desc);
+    } else if (auto builder_or = store_->AcquireBuilder(); !builder_or.ok()) {
+      entry.rules = builder_or.status();
+    } else {
+      internal::RuleCompiler compiler(*builder_or.value(), &store_->caches_);
+      entry.rules = internal::NewMessageRules(
+          messageFactory_, allowUnknownFields_, &entry.arena, compiler, desc);
+      store_->ReleaseBuilder(std::move(builder_or).value());
+    }
+    if (entry.rules.ok()) {
+      entry.plan = internal::NewTraversalPlan(desc, &reachability_);
+      entry.bytes = sizeof(CompiledType) + entry.plan.SpaceUsed() +
+          entry.rules.value().capacity() * sizeof(entry.rules.value()[0]);
+      for (const auto& rule : entry.rules.value()) {
+        entry.bytes += rule->SpaceUsed();
+      }
+    }
+    entry.bytes += entry.arena.SpaceAllocated();
+    entry.compiled.store(true, std::memory_order_release);
+    if (compiled != nullptr) {
+      *compiled = true;
+    }
+  });
+  return entry.rules;
+}
+
+absl::StatusOr<std::unique_ptr<ReloadingValidatorFactory>> ReloadingValidatorFactory::New(
+    std::shared_ptr<CompiledRuleStore> store, Configure configure) {
+  if (store == nullptr) {
+    auto store_or = CompiledRuleStore::New();
+    if (!store_or.ok()) {
+      return store_or.status();
+    }
+    store = std::move(store_or).value();
+  }
+  auto factory_or = ValidatorFactory::New(store);
+  if (!factory_or.ok()) {
+    return factory_or.status();
+  }
+  auto factory = std::move(factory_or).value();
+  if (configure) {
+    configure(*factory);
+  }
+  return std::unique_ptr<ReloadingValidatorFactory>(new ReloadingValidatorFactory(
+      std::move(store), std::move(configure), std::move(factory)));
+}
+
+absl::Status ReloadingValidatorFactory::Reload(
+    absl::Span<const google::protobuf::FileDescriptor* const> files,
+    std::shared_ptr<const void> resources,
+    const Configure& configure,
+    const ValidatorFactory::Executor& executor) {
+  absl::MutexLock reloadLock(&reloadMutex_);
+  auto factory_or = ValidatorFactory::New(store_);
+  if (!factory_or.ok()) {
+    return factory_or.status();
+  }
+  // The factory refers to the descriptors in resources, so destroy it first.
+  std::shared_ptr<ValidatorFactory> factory(
+      std::move(factory_or).value().release(),
+      [resources = std::move(resources)](ValidatorFactory* factory) { delete factory; });
+  if (configure_) {
+    configure_(*factory);
+  }
+  if (configure) {
+    configure(*factory);
+  }
+  // Types that did not change keep their compiled rules; only the others are compiled.
+  factory->ShareUnchanged(*Current(), files);
+  auto errors = factory->AddAll(files, executor);
+  if (!errors.empty()) {
+    const auto& [desc, status] = *errors.begin();
+    return absl::Status(
+        status.code(),
+        absl::StrCat("failed to compile ", desc->full_name(), ": ", status.message()));
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    std::swap(current_, factory);
+    generation_++;
+  }
+  // The previous generation is released here, outside the lock, and destroyed once the last
+  // validator using it is gone.
+  return absl::OkStatus();
 }
 
 } // namespace buf::validate
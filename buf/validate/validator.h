@@ -14,24 +14,65 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <limits>
 #include <memory>
+#include <string>
 #include <string_view>
+#include <thread>
 #include <utility>
+#include <vector>
 
+#include "absl/base/call_once.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/node_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "buf/validate/internal/message_factory.h"
 #include "buf/validate/internal/message_rules.h"
+#include "buf/validate/internal/pointer_map.h"
+#include "buf/validate/internal/regex_cache.h"
+#include "buf/validate/internal/rule_compiler.h"
 #include "buf/validate/internal/rules.h"
+#include "buf/validate/internal/traversal_plan.h"
 #include "buf/validate/validate.pb.h"
 #include "eval/public/cel_expression.h"
 #include "google/protobuf/message.h"
 
 namespace buf::validate {
 
+using internal::Clock;
 using internal::ProtoField;
 using internal::RuleViolation;
 
 class ValidatorFactory;
 
+namespace internal {
+
+/// A message type whose compiled rules and traversal plan, and the linked types of the fields
+/// the plan descends into, are resolved ahead of time, so that validating it looks nothing up.
+struct LinkedType {
+  const Rules* rules = nullptr;
+  const TraversalPlan* plan = nullptr;
+  /// The linked type of each field in plan->fields, by index, or nullptr if the field's entry
+  /// type is malformed.
+  std::vector<const LinkedType*> fields;
+};
+
+/// The linked types reachable from a root message type. Types link to each other directly, so
+/// recursive types form cycles.
+struct LinkedGraph {
+  const google::protobuf::Descriptor* root = nullptr;
+  /// The root type comes first.
+  std::vector<LinkedType> types;
+};
+
+} // namespace internal
+
 /// The ValidationResult class contains information about the validation.
 class ValidationResult {
  public:
@@ -73,6 +114,11 @@ class Validator {
   /// If there is an error while validating, a Status with the error is returned.
   absl::StatusOr<ValidationResult> Validate(const google::protobuf::Message& message);
 
+  /// Sets the clock read for the `now` variable of rules, overriding the clock of the factory.
+  /// The clock is read at most once per call to Validate. The clock must outlive the validator;
+  /// nullptr restores the factory's clock.
+  void SetClock(const Clock* clock) { clock_ = clock; }
+
   // Move only.
   Validator(const Validator&) = delete;
   Validator& operator=(const Validator&) = delete;
@@ -81,18 +127,154 @@ class Validator {
 
  private:
   friend class ValidatorFactory;
+  friend class ReloadingValidatorFactory;
 
   ValidatorFactory* factory_;
   google::protobuf::Arena* arena_;
   bool failFast_;
+  const Clock* clock_ = nullptr;
+  // The pre-linked types, for validators created by ValidatorFactory::NewValidatorFor.
+  std::shared_ptr<const internal::LinkedGraph> linked_;
+  // Keeps factory_ alive, for validators created from a ReloadingValidatorFactory generation.
+  std::shared_ptr<ValidatorFactory> generation_;
 
   Validator(ValidatorFactory* factory, google::protobuf::Arena* arena, bool failFast) noexcept
       : factory_(factory), arena_(arena), failFast_(failFast) {}
 
+  Validator(
+      std::shared_ptr<ValidatorFactory> generation,
+      google::protobuf::Arena* arena,
+      bool failFast) noexcept
+      : factory_(generation.get()),
+        arena_(arena),
+        failFast_(failFast),
+        generation_(std::move(generation)) {}
+
+  // A unit of work of the traversal: visiting a message, or, once every message below it has been
+  // visited, prefixing the field path of the violations found there with the field it was
+  // reached through.
+  struct Step {
+    const google::protobuf::Message* message = nullptr;
+    // The field message was reached through, with its index or map entry. Unset for the root.
+    internal::TraversalPlan::Field field;
+    int index = -1;
+    const google::protobuf::Message* mapEntry = nullptr;
+    int depth = 0;
+    // For exit steps, the number of violations when the message was entered. -1 for visits.
+    int pos = -1;
+    // The linked type of message, if it was reached from a pre-linked type.
+    const internal::LinkedType* linked = nullptr;
+  };
+
+  // The work stack of the traversal, kept to reuse its allocation.
+  std::vector<Step> stack_;
+
   absl::Status ValidateMessage(
       internal::RuleContext& ctx, const google::protobuf::Message& message);
 
-  absl::Status ValidateFields(internal::RuleContext& ctx, const google::protobuf::Message& message);
+  // Validates the rules of the message of step, and pushes the steps that visit its fields.
+  absl::Status VisitMessage(internal::RuleContext& ctx, const Step& step);
+
+  absl::Status PushFields(
+      const google::protobuf::Message& message,
+      const internal::TraversalPlan::Field& planned,
+      const internal::LinkedType* linked,
+      int depth);
+};
+
+/// Compiled rule state that does not depend on any descriptor pool, and can therefore be shared
+/// by several ValidatorFactory instances, including factories over different pools.
+///
+/// Everything in the store is addressed by content: parsed and planned expressions by their
+/// text, and compiled field rule sets by field type and the serialized FieldRules. Factories
+/// whose pools contain identical files therefore compile each distinct rule once. Rules that
+/// depend on a factory's own message factory, such as predefined rules defined in a dynamic
+/// pool, are never shared.
+class CompiledRuleStore {
+ public:
+  /// Create a new, empty store, with its own expression builders.
+  static absl::StatusOr<std::shared_ptr<CompiledRuleStore>> New();
+
+  /// Create a new, empty store that borrows its expression builders from a process-wide pool.
+  /// The builders, and the CEL function registries they hold, are created once per process, so
+  /// creating such a store is cheap, while its caches are its own and are released with it.
+  /// ValidatorFactory::New uses a store created this way.
+  static absl::StatusOr<std::shared_ptr<CompiledRuleStore>> NewWithSharedBuilders();
+
+  /// Not copyable or movable.
+  CompiledRuleStore(const CompiledRuleStore&) = delete;
+  CompiledRuleStore& operator=(const CompiledRuleStore&) = delete;
+
+  /// Returns a snapshot of every rule expression parsed so far. Loading the snapshot into
+  /// another store, for example in a new process built from the same schema, lets it skip
+  /// parsing those expressions again. Snapshots are versioned binary blobs that are safe to
+  /// write to a file and memory-map.
+  [[nodiscard]] std::string SaveSnapshot() const { return caches_.expressions.SaveSnapshot(); }
+
+  /// Loads a snapshot created by SaveSnapshot. Expressions are decoded lazily, directly from the
+  /// snapshot data, which must outlive the store. Returns an error if the snapshot is corrupt
+  /// or was written by an incompatible version.
+  absl::Status LoadSnapshot(std::string_view snapshot) {
+    return caches_.expressions.LoadSnapshot(snapshot);
+  }
+
+  /// Sets the RE2 max_mem option used to compile `matches()` patterns that are not constant in
+  /// their expression. Such patterns are compiled once and cached by every factory that uses this
+  /// store. Patterns that do not compile within the limit fail to match with an error. Stores
+  /// created with NewWithSharedBuilders cache patterns with the shared builders, whose settings
+  /// are fixed, so a FailedPrecondition error is returned for them.
+  absl::Status SetRegexMaxMemory(int64_t bytes) {
+    if (builderSource_ != nullptr) {
+      return absl::FailedPreconditionError(
+          "the regex memory limit cannot be set on a store with shared builders");
+    }
+    regexCache_.SetMaxMemory(bytes);
+    return absl::OkStatus();
+  }
+
+  /// Returns the number of distinct programs planned in the store so far.
+  [[nodiscard]] size_t ProgramCount() const { return caches_.programs.size(); }
+
+  /// Returns how many rule expressions the store has parsed from their text. Expressions found
+  /// in a loaded snapshot are decoded instead, and not counted.
+  [[nodiscard]] size_t ParseCount() const { return caches_.expressions.ParseCount(); }
+
+  /// Returns how many times factories using the store have compiled the rules of a message type.
+  /// A type is counted again for each factory that compiles it, and each time it is compiled
+  /// again after being evicted.
+  [[nodiscard]] size_t TypeCompileCount() const {
+    return typeCompiles_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  friend class ValidatorFactory;
+
+  // The pool this store borrows its builders from, if created with NewWithSharedBuilders.
+  // Declared first so that it outlives the cached programs, which refer to its builders.
+  std::shared_ptr<CompiledRuleStore> builderSource_;
+  // Whether constants folded by the builders are owned by the programs they were folded into,
+  // rather than allocated on arena_. Set for the process-wide pool, so that planning programs for
+  // short-lived stores never grows its arena.
+  bool programOwnedConstants_ = false;
+  google::protobuf::Arena arena_;
+  // Compiled patterns of dynamic `matches()` calls, referred to by the builders' registries.
+  internal::RegexCache regexCache_;
+  // Idle expression builders. Each compilation borrows one for its duration, so concurrent
+  // compilations never share a builder. Builders are kept for the lifetime of the store, since
+  // compiled expressions refer to the functions registered with them.
+  absl::Mutex builderMutex_;
+  std::vector<std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder>> builders_
+      ABSL_GUARDED_BY(builderMutex_);
+  internal::CompilerCaches caches_;
+  std::atomic<size_t> typeCompiles_{0};
+
+  CompiledRuleStore() = default;
+
+  absl::StatusOr<std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder>>
+  AcquireBuilder();
+
+  void ReleaseBuilder(
+      std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder> builder);
 };
 
 /// A factory that stores shared state for creating validators.
@@ -102,14 +284,32 @@ class Validator {
 /// one factory per process, and one validator created per ~request.
 class ValidatorFactory {
  public:
-  /// Create a new factory.
+  /// Create a new factory, with a store of its own created with
+  /// CompiledRuleStore::NewWithSharedBuilders. Compiled rules are not shared with other
+  /// factories, but creating the factory does not register any CEL function.
   static absl::StatusOr<std::unique_ptr<ValidatorFactory>> New();
 
+  /// Create a new factory that shares compiled rules with every other factory using store.
+  static absl::StatusOr<std::unique_ptr<ValidatorFactory>> New(
+      std::shared_ptr<CompiledRuleStore> store);
+
   /// Create a new validator using the given arena for allocations during validation.
   [[nodiscard]] Validator NewValidator(google::protobuf::Arena* arena, bool failFast = false) {
     return {this, arena, failFast};
   }
 
+  /// Create a new validator for messages of type desc. The rules of desc, and of every type its
+  /// messages may contain, are compiled as with Add, and linked to each other once per factory,
+  /// so that validating a message of type desc takes no locks and does no lookups. Messages of
+  /// other types are validated as with NewValidator. Returns an error if any of the rules fail
+  /// to compile.
+  absl::StatusOr<Validator> NewValidatorFor(
+      const google::protobuf::Descriptor* desc,
+      google::protobuf::Arena* arena,
+      bool failFast = false);
+
+  ~ValidatorFactory();
+
   /// Not copyable or movable.
   ValidatorFactory(const ValidatorFactory&) = delete;
   ValidatorFactory& operator=(const ValidatorFactory&) = delete;
@@ -119,6 +319,69 @@ class ValidatorFactory {
   /// Populates the factory with rules for the given message type.
   absl::Status Add(const google::protobuf::Descriptor* desc);
 
+  /// Schedules a task to run, typically on a thread pool.
+  using Executor = std::function<void(std::function<void()>)>;
+
+  /// Compilation errors reported by AddAll, keyed by message type.
+  using AddErrors = absl::flat_hash_map<const google::protobuf::Descriptor*, absl::Status>;
+
+  /// Populates the factory with rules for every message type declared in the given files,
+  /// including nested types, and for every message type they reference. To precompile a whole
+  /// descriptor pool, pass all of its files.
+  ///
+  /// Independent message types are compiled concurrently by tasks scheduled on executor, each
+  /// with its own expression builder. If no executor is given, all types are compiled on the
+  /// calling thread. Returns once every type has been compiled; types whose rules failed to
+  /// compile are reported in the result.
+  AddErrors AddAll(
+      absl::Span<const google::protobuf::FileDescriptor* const> files,
+      const Executor& executor = nullptr) {
+    return AddAll(files, "", executor);
+  }
+
+  /// Like AddAll, but only considers files in the given package or one of its sub-packages.
+  AddErrors AddAll(
+      absl::Span<const google::protobuf::FileDescriptor* const> files,
+      std::string_view package,
+      const Executor& executor = nullptr);
+
+  /// Compiles rules for the given message types, and every type they reference, in the
+  /// background, and returns immediately with one future per given type. Each future becomes
+  /// ready with the compilation status once that type has been compiled.
+  ///
+  /// Validation does not wait for warmup to finish: a message whose type is still compiling
+  /// waits for that type only, and a type that has not been reached yet is compiled on demand.
+  /// The work runs as a single task on executor, which must finish before the factory is
+  /// destroyed; without an executor, it runs on a thread owned by the factory.
+  std::vector<std::shared_future<absl::Status>> Warmup(
+      absl::Span<const google::protobuf::Descriptor* const> types,
+      const Executor& executor = nullptr);
+
+  /// Returns a snapshot of every rule expression this factory has parsed so far. See
+  /// CompiledRuleStore::SaveSnapshot.
+  [[nodiscard]] std::string SaveSnapshot() const { return store_->SaveSnapshot(); }
+
+  /// Loads a snapshot created by SaveSnapshot. The snapshot data must outlive the factory, and
+  /// any other factory sharing its store. See CompiledRuleStore::LoadSnapshot.
+  absl::Status LoadSnapshot(std::string_view snapshot) { return store_->LoadSnapshot(snapshot); }
+
+  /// Returns the store holding this factory's compiled rules.
+  [[nodiscard]] const std::shared_ptr<CompiledRuleStore>& store() const { return store_; }
+
+  /// Returns an estimate of the memory held by the compiled rules of each message type, in bytes.
+  /// State shared between types, such as planned programs and interned field rule sets, is not
+  /// attributed to any type.
+  [[nodiscard]] absl::flat_hash_map<const google::protobuf::Descriptor*, size_t> MemoryUsage() const;
+
+  /// Sets a memory budget, in bytes, for the compiled rules of lazily loaded message types. When
+  /// their estimated usage exceeds the budget, the least recently used of them are evicted, and
+  /// compiled again on next use. Types added with Add, AddAll or Warmup are never evicted. Zero,
+  /// the default, disables eviction. Must be called before the factory creates any validator.
+  ///
+  /// The rule values of violations may refer to the compiled rules, so with a budget, they are
+  /// only valid until the type of the violating message is evicted.
+  void SetMemoryBudget(size_t bytes) { memoryBudget_ = bytes; }
+
   /// Disable lazy loading of rules.
   void DisableLazyLoading(bool disable = true) {
     absl::WriterMutexLock lock(&mutex_);
@@ -136,21 +399,223 @@ class ValidatorFactory {
   /// Set whether or not unknown rule fields will be tolerated. Defaults to false.
   void SetAllowUnknownFields(bool allowUnknownFields) { allowUnknownFields_ = allowUnknownFields; }
 
+  /// Sets the clock read for the `now` variable of rules, for example to replay validations
+  /// deterministically or to use a cheaper, coarser clock. Each call to Validator::Validate reads
+  /// the clock at most once. Defaults to the system clock. Must be called before the factory
+  /// creates any validator.
+  void SetClock(std::shared_ptr<const Clock> clock) { nowClock_ = std::move(clock); }
+
+  /// Sets the maximum depth of nested messages that validation descends into, where fields of
+  /// the validated message are at depth 1. Validating a message nested any deeper fails with an
+  /// InvalidArgument error. Defaults to no limit. Must be called before the factory creates any
+  /// validator.
+  void SetMaxDepth(int depth) { maxDepth_ = depth; }
+
  private:
   friend class Validator;
-  google::protobuf::Arena arena_;
-  absl::Mutex mutex_;
+  friend class ReloadingValidatorFactory;
+
+  // The compiled rules for a single message type, compiled outside of mutex_ exactly once, so
+  // compiling one type only blocks callers that need that same type.
+  struct CompiledType {
+    absl::once_flag once;
+    // Rule values, field rule overrides and reparsed rules of this type, freed with the rules
+    // when the type is evicted. Declared first so that it outlives the rules.
+    google::protobuf::Arena arena;
+    internal::Rules rules;
+    // The fields validation descends into, built along with rules.
+    internal::TraversalPlan plan;
+    // The estimated size of rules, plan and arena, set once they are compiled.
+    size_t bytes = 0;
+    std::atomic<bool> compiled{false};
+  };
+
+  // The state of a single message type. Entries are created with mutex_ held, and live as long as
+  // the factory, while their compiled rules are replaced each time the type is loaded again after
+  // being evicted.
+  struct RulesEntry {
+    // The compiled rules, or nullptr while the type is evicted. Only replaced with mutex_ held.
+    std::atomic<CompiledType*> current{nullptr};
+    // Owns current. Shared with the next generation of a ReloadingValidatorFactory if the type did
+    // not change. Guarded by mutex_.
+    std::shared_ptr<CompiledType> owner;
+    // Whether the entry was created by lazy loading, and can therefore be evicted, and whether
+    // the size of current is included in lazyBytes_. Guarded by mutex_.
+    bool lazy = false;
+    bool counted = false;
+    // Set on each use, and cleared by the eviction clock hand.
+    std::atomic<bool> referenced{false};
+    // With a memory budget, the number of validations using current. Rules evicted while in use
+    // are kept alive by retired, and released by the last of those validations.
+    std::atomic<int64_t> readers{0};
+    std::atomic<std::shared_ptr<CompiledType>*> retired{nullptr};
+
+    RulesEntry() = default;
+    RulesEntry(const RulesEntry&) = delete;
+    RulesEntry& operator=(const RulesEntry&) = delete;
+    ~RulesEntry() { delete retired.load(std::memory_order_relaxed); }
+  };
+
+  // Releases the rules pinned by GetMessageRules when destroyed.
+  class RulesPin {
+   public:
+    RulesPin() = default;
+    RulesPin(const RulesPin&) = delete;
+    RulesPin& operator=(const RulesPin&) = delete;
+    ~RulesPin() {
+      if (entry_ != nullptr) {
+        Unpin(*entry_);
+      }
+    }
+
+   private:
+    friend class ValidatorFactory;
+    RulesEntry* entry_ = nullptr;
+  };
+
+  using RulesMap = absl::node_hash_map<const google::protobuf::Descriptor*, RulesEntry>;
+
+  // Declared first so that it outlives the compiled rules, which refer to it.
+  std::shared_ptr<CompiledRuleStore> store_;
+  mutable absl::Mutex mutex_;
   std::unique_ptr<internal::MessageFactory> messageFactory_;
-  bool allowUnknownFields_;
-  absl::flat_hash_map<const google::protobuf::Descriptor*, internal::Rules> rules_
-      ABSL_GUARDED_BY(mutex_);
-  std::unique_ptr<google::api::expr::runtime::CelExpressionBuilder> builder_
-      ABSL_GUARDED_BY(mutex_);
+  bool allowUnknownFields_ = false;
+  std::shared_ptr<const Clock> nowClock_;
+  int maxDepth_ = std::numeric_limits<int>::max();
+  RulesMap rules_ ABSL_GUARDED_BY(mutex_);
+  // Lock-free view of rules_, read on every message visited during validation. Writes happen
+  // with mutex_ held.
+  internal::PointerMap<google::protobuf::Descriptor, RulesEntry> index_;
   bool disableLazyLoading_ ABSL_GUARDED_BY(mutex_) = false;
+  // Eviction of lazily loaded types. Lazy entries are visited in clock_ order by a CLOCK hand,
+  // which evicts the compiled rules of entries that have not been referenced since its last pass.
+  size_t memoryBudget_ = 0;
+  size_t lazyBytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  std::vector<const google::protobuf::Descriptor*> clock_ ABSL_GUARDED_BY(mutex_);
+  size_t clockHand_ ABSL_GUARDED_BY(mutex_) = 0;
+  absl::Mutex warmupMutex_;
+  std::vector<std::thread> warmupThreads_ ABSL_GUARDED_BY(warmupMutex_);
+  // Which types reach rules, shared by the traversal plans of every type.
+  internal::RulesReachability reachability_;
+  // The graphs linked by NewValidatorFor, by root type. Each graph is linked outside of
+  // linkMutex_ exactly once, so linking one root only blocks callers that need that same root.
+  struct LinkedEntry {
+    absl::once_flag once;
+    absl::StatusOr<std::shared_ptr<const internal::LinkedGraph>> graph;
+  };
+  absl::Mutex linkMutex_;
+  absl::node_hash_map<const google::protobuf::Descriptor*, LinkedEntry> linked_
+      ABSL_GUARDED_BY(linkMutex_);
+
+  explicit ValidatorFactory(std::shared_ptr<CompiledRuleStore> store) : store_(std::move(store)) {}
+
+  // Returns the compiled rules of desc, or nullptr if they are not loaded and cannot be. With a
+  // memory budget, the rules are pinned by pin, so that they are not freed while in use.
+  const CompiledType* GetMessageRules(const google::protobuf::Descriptor* desc, RulesPin& pin);
+
+  // Returns the entry of desc, with rules to compile if it has none.
+  RulesEntry* FindOrAddEntry(const google::protobuf::Descriptor* desc, bool lazy);
+
+  // Shares the compiled rules of every type in files that previous has compiled, provided they
+  // were compiled with the same settings. Rules refer to the descriptors they were compiled from,
+  // so a type is only shared if its descriptor is the same.
+  void ShareUnchanged(
+      const ValidatorFactory& previous,
+      absl::Span<const google::protobuf::FileDescriptor* const> files);
 
-  ValidatorFactory() = default;
+  // Releases rules pinned by GetMessageRules, freeing them if they were evicted meanwhile.
+  static void Unpin(RulesEntry& entry);
+
+  // Returns the linked graph of root, linking it on first use.
+  absl::StatusOr<std::shared_ptr<const internal::LinkedGraph>> Link(
+      const google::protobuf::Descriptor* root);
+
+  // Compiles every type reachable from root, and links them.
+  absl::StatusOr<std::shared_ptr<const internal::LinkedGraph>> LinkGraph(
+      const google::protobuf::Descriptor* root);
+
+  // Evicts lazily loaded types until their usage is within the budget.
+  void EvictLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const internal::Rules& CompileEntry(
+      CompiledType& entry,
+      const google::protobuf::Descriptor* desc,
+      google::api::expr::runtime::CelExpressionBuilder* builder = nullptr,
+      bool* compiled = nullptr);
+};
+
+/// A ValidatorFactory that can be reloaded with new schemas while it is in use.
+///
+/// Each successful Reload publishes a new generation: a ValidatorFactory precompiled for the new
+/// files. Validators keep using the generation that was current when they were created until
+/// they are destroyed, so in-flight validation is never paused or switched midway. Types whose
+/// descriptors are the same as in the previous generation, such as those of a pool that was only
+/// extended, keep their compiled rules if the generation is configured with the same message
+/// factory and unknown field setting. Every generation shares one CompiledRuleStore, so the
+/// rule expressions of other types are not parsed or planned again either.
+class ReloadingValidatorFactory {
+ public:
+  /// Configures a generation before any of its rules are compiled, typically by calling its
+  /// setters: SetMessageFactory, SetAllowUnknownFields, DisableLazyLoading, SetMemoryBudget,
+  /// SetMaxDepth and SetClock.
+  using Configure = std::function<void(ValidatorFactory& factory)>;
+
+  /// Create a new reloading factory. Its initial generation has no precompiled types, and
+  /// compiles rules lazily like a plain ValidatorFactory. If given, configure is applied to the
+  /// initial generation and to every generation published by Reload.
+  static absl::StatusOr<std::unique_ptr<ReloadingValidatorFactory>> New(
+      std::shared_ptr<CompiledRuleStore> store = nullptr, Configure configure = nullptr);
+
+  /// Not copyable or movable.
+  ReloadingValidatorFactory(const ReloadingValidatorFactory&) = delete;
+  ReloadingValidatorFactory& operator=(const ReloadingValidatorFactory&) = delete;
+
+  /// Compiles rules for every message type in files, as ValidatorFactory::AddAll does, and then
+  /// atomically publishes them as the new current generation. The files typically make up a
+  /// new descriptor pool; resources, such as that pool, are kept alive for as long as the new
+  /// generation is in use. If any type fails to compile, the current generation is kept and one
+  /// of the errors is returned. Concurrent calls to Reload are serialized.
+  ///
+  /// The new generation is configured by the configure function given to New, and then by
+  /// configure, if given, for settings that belong to this generation only, such as the message
+  /// factory of a new dynamic pool.
+  absl::Status Reload(
+      absl::Span<const google::protobuf::FileDescriptor* const> files,
+      std::shared_ptr<const void> resources = nullptr,
+      const Configure& configure = nullptr,
+      const ValidatorFactory::Executor& executor = nullptr);
+
+  /// Create a new validator bound to the current generation.
+  [[nodiscard]] Validator NewValidator(
+      google::protobuf::Arena* arena, bool failFast = false) const {
+    return {Current(), arena, failFast};
+  }
+
+  /// Returns the current generation. It stays valid for as long as the pointer is held.
+  [[nodiscard]] std::shared_ptr<ValidatorFactory> Current() const {
+    absl::ReaderMutexLock lock(&mutex_);
+    return current_;
+  }
+
+  /// Returns the number of generations published by Reload so far.
+  [[nodiscard]] uint64_t generation() const {
+    absl::ReaderMutexLock lock(&mutex_);
+    return generation_;
+  }
+
+ private:
+  std::shared_ptr<CompiledRuleStore> store_;
+  const Configure configure_;
+  absl::Mutex reloadMutex_;
+  mutable absl::Mutex mutex_;
+  std::shared_ptr<ValidatorFactory> current_ ABSL_GUARDED_BY(mutex_);
+  uint64_t generation_ ABSL_GUARDED_BY(mutex_) = 0;
 
-  const internal::Rules* GetMessageRules(const google::protobuf::Descriptor* desc);
+  ReloadingValidatorFactory(
+      std::shared_ptr<CompiledRuleStore> store,
+      Configure configure,
+      std::shared_ptr<ValidatorFactory> current)
+      : store_(std::move(store)), configure_(std::move(configure)), current_(std::move(current)) {}
 };
 
 } // namespace buf::validate
@@ -0,0 +1,76 @@
+// Copyright 2023-2026 Buf Technologies, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "benchmark/benchmark.h"
+#include "buf/validate/conformance/cases/repeated.pb.h"
+#include "buf/validate/validator.h"
+
+namespace buf::validate {
+namespace {
+
+ValidatorFactory& SharedFactory() {
+  static ValidatorFactory* factory = [] {
+    auto factory = ValidatorFactory::New().value();
+    auto status = factory->Add(conformance::cases::RepeatedEmbedNone::descriptor());
+    if (!status.ok()) {
+      abort();
+    }
+    return factory.release();
+  }();
+  return *factory;
+}
+
+// Validates a message with many nested messages from several threads sharing one factory. Each
+// nested message costs one rules lookup, so items/s per thread should stay flat as threads are
+// added if the lookup does not contend.
+void BM_ValidateNestedMessages(benchmark::State& state) {
+  auto& factory = SharedFactory();
+  conformance::cases::RepeatedEmbedNone message;
+  for (int i = 0; i < 64; i++) {
+    message.add_val()->set_val(i + 1);
+  }
+  google::protobuf::Arena arena;
+  auto validator = factory.NewValidator(&arena, false);
+  int64_t iterations = 0;
+  for (auto _ : state) {
+    auto result = validator.Validate(message);
+    benchmark::DoNotOptimize(result);
+    if (++iterations % 1024 == 0) {
+      arena.Reset();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (message.val_size() + 1));
+}
+BENCHMARK(BM_ValidateNestedMessages)->ThreadRange(1, 64)->UseRealTime();
+
+// Creates a factory whose store borrows expression builders that already exist.
+void BM_NewFactory(benchmark::State& state) {
+  for (auto _ : state) {
+    auto factory = ValidatorFactory::New();
+    benchmark::DoNotOptimize(factory);
+  }
+}
+BENCHMARK(BM_NewFactory);
+
+// Creates a factory with a store of its own, which registers every CEL function again.
+void BM_NewFactoryWithStore(benchmark::State& state) {
+  for (auto _ : state) {
+    auto factory = ValidatorFactory::New(CompiledRuleStore::New().value());
+    benchmark::DoNotOptimize(factory);
+  }
+}
+BENCHMARK(BM_NewFactoryWithStore);
+
+} // namespace
+} // namespace buf::validate
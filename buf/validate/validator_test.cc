@@ -14,15 +14,27 @@
 
 #include "buf/validate/validator.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
 #include "buf/validate/conformance/cases/bool.pb.h"
 #include "buf/validate/conformance/cases/bytes.pb.h"
 #include "buf/validate/conformance/cases/custom_rules/custom_rules.pb.h"
+#include "buf/validate/conformance/cases/messages.pb.h"
 #include "buf/validate/conformance/cases/repeated.pb.h"
 #include "buf/validate/conformance/cases/strings.pb.h"
+#include "buf/validate/conformance/cases/wkt_timestamp.pb.h"
 #include "eval/public/activation.h"
 #include "eval/public/builtin_func_registrar.h"
 #include "eval/public/cel_expr_builder_factory.h"
 #include "gmock/gmock.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/dynamic_message.h"
 #include "gtest/gtest.h"
 #include "parser/parser.h"
 
@@ -41,6 +53,20 @@ Matcher<ProtoField> FieldIndex(int index, Matcher<ProtoField> matcher) {
   return ResultOf([index](ProtoField field) { return field.at(index); }, Optional(matcher));
 }
 
+// Copies file, and the files it depends on, into pool.
+void copyFile(
+    const google::protobuf::FileDescriptor* file, google::protobuf::DescriptorPool& pool) {
+  if (pool.FindFileByName(file->name()) != nullptr) {
+    return;
+  }
+  for (int i = 0; i < file->dependency_count(); i++) {
+    copyFile(file->dependency(i), pool);
+  }
+  google::protobuf::FileDescriptorProto proto;
+  file->CopyTo(&proto);
+  ASSERT_NE(pool.BuildFile(proto), nullptr) << file->name();
+}
+
 TEST(ValidatorTest, ParseAndEval) {
   std::string input = "1 + 2";
   auto pexpr_or = cel::parser::Parse(input);
@@ -482,5 +508,622 @@ TEST(ValidatorTest, MessageRule) {
   EXPECT_EQ(violations_or.value().violations(2).proto().message(), "a must be greater than b");
 }
 
+TEST(ValidatorTest, ConcurrentLazyLoading) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&factory] {
+      conformance::cases::StringContains str_contains;
+      str_contains.set_val("somethingwithout");
+      conformance::cases::BytesContains bytes_contains;
+      bytes_contains.set_val("foobar");
+      google::protobuf::Arena arena;
+      auto validator = factory->NewValidator(&arena, false);
+      for (int j = 0; j < 16; j++) {
+        auto violations_or = validator.Validate(str_contains);
+        ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+        ASSERT_EQ(violations_or.value().violations_size(), 1);
+        EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+        violations_or = validator.Validate(bytes_contains);
+        ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+        EXPECT_EQ(violations_or.value().violations_size(), 0);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+TEST(ValidatorTest, AddAllConcurrently) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  factory->DisableLazyLoading();
+  std::vector<std::thread> threads;
+  auto errors = factory->AddAll(
+      {conformance::cases::StringContains::descriptor()->file()},
+      [&threads](std::function<void()> task) { threads.emplace_back(std::move(task)); });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_FALSE(threads.empty());
+  EXPECT_FALSE(errors.contains(conformance::cases::StringContains::descriptor()));
+  conformance::cases::StringContains str_contains;
+  str_contains.set_val("somethingwithout");
+  google::protobuf::Arena arena;
+  auto validator = factory->NewValidator(&arena, false);
+  auto violations_or = validator.Validate(str_contains);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+}
+
+TEST(ValidatorTest, AddAllPackageFilter) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  factory->DisableLazyLoading();
+  auto errors = factory->AddAll(
+      {conformance::cases::StringContains::descriptor()->file()}, "some.other.package");
+  EXPECT_TRUE(errors.empty());
+  conformance::cases::StringContains str_contains;
+  google::protobuf::Arena arena;
+  auto validator = factory->NewValidator(&arena, false);
+  auto violations_or = validator.Validate(str_contains);
+  ASSERT_FALSE(violations_or.ok());
+  EXPECT_EQ(violations_or.status().code(), absl::StatusCode::kNotFound);
+}
+
+TEST(ValidatorTest, Warmup) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  factory->DisableLazyLoading();
+  auto ready = factory->Warmup({
+      conformance::cases::StringContains::descriptor(),
+      conformance::cases::BytesContains::descriptor(),
+  });
+  ASSERT_EQ(ready.size(), 2);
+  conformance::cases::StringContains str_contains;
+  str_contains.set_val("somethingwithout");
+  google::protobuf::Arena arena;
+  auto validator = factory->NewValidator(&arena, false);
+  // Does not need to wait for the futures: validation waits for the type it needs.
+  auto violations_or = validator.Validate(str_contains);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+  for (auto& future : ready) {
+    EXPECT_TRUE(future.get().ok()) << future.get();
+  }
+}
+
+TEST(ValidatorTest, Snapshot) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  ASSERT_TRUE(factory->Add(conformance::cases::StringContains::descriptor()).ok());
+  EXPECT_GT(factory->store()->ParseCount(), 0);
+  std::string snapshot = factory->SaveSnapshot();
+
+  factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  factory = std::move(factory_or).value();
+  auto status = factory->LoadSnapshot(snapshot);
+  ASSERT_TRUE(status.ok()) << status;
+  conformance::cases::StringContains str_contains;
+  str_contains.set_val("somethingwithout");
+  google::protobuf::Arena arena;
+  auto validator = factory->NewValidator(&arena, false);
+  auto violations_or = validator.Validate(str_contains);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+  // Every expression was decoded from the snapshot rather than parsed.
+  EXPECT_EQ(factory->store()->ParseCount(), 0);
+  EXPECT_GT(factory->store()->ProgramCount(), 0);
+  EXPECT_EQ(factory->SaveSnapshot(), snapshot);
+}
+
+TEST(ValidatorTest, SharesPrograms) {
+  // Two types whose fields share a rule expression, but not their whole rule sets.
+  google::protobuf::DescriptorPool pool;
+  copyFile(FieldRules::descriptor()->file(), pool);
+  google::protobuf::FileDescriptorProto file;
+  file.set_name("shares_programs.proto");
+  file.set_package("shares_programs");
+  file.set_syntax("proto3");
+  file.add_dependency(FieldRules::descriptor()->file()->name());
+  const std::vector<std::vector<std::string>> expressionsByType = {
+      {"this > 0"},
+      {"this > 0", "this < 100"},
+  };
+  for (const auto& expressions : expressionsByType) {
+    auto* message = file.add_message_type();
+    message->set_name(absl::StrCat("Message", file.message_type_size()));
+    auto* field = message->add_field();
+    field->set_name("val");
+    field->set_number(1);
+    field->set_type(google::protobuf::FieldDescriptorProto::TYPE_INT32);
+    field->set_label(google::protobuf::FieldDescriptorProto::LABEL_OPTIONAL);
+    auto& rules = *field->mutable_options()->MutableExtension(buf::validate::field);
+    for (const auto& expression : expressions) {
+      auto& rule = *rules.add_cel();
+      rule.set_id(expression);
+      rule.set_expression(expression);
+    }
+  }
+  const auto* built = pool.BuildFile(file);
+  ASSERT_NE(built, nullptr);
+
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  ASSERT_TRUE(factory->Add(built->message_type(0)).ok());
+  EXPECT_EQ(factory->store()->ProgramCount(), 1);
+  // Only the expression the first type does not have is planned.
+  ASSERT_TRUE(factory->Add(built->message_type(1)).ok());
+  EXPECT_EQ(factory->store()->ProgramCount(), 2);
+}
+
+TEST(ValidatorTest, SharedStore) {
+  auto store_or = CompiledRuleStore::New();
+  ASSERT_TRUE(store_or.ok()) << store_or.status();
+  auto store = std::move(store_or).value();
+  auto first_or = ValidatorFactory::New(store);
+  ASSERT_TRUE(first_or.ok()) << first_or.status();
+  auto first = std::move(first_or).value();
+  ASSERT_TRUE(first->Add(conformance::cases::StringContains::descriptor()).ok());
+  size_t programs = store->ProgramCount();
+  size_t parses = store->ParseCount();
+  EXPECT_GT(programs, 0);
+  EXPECT_GT(parses, 0);
+
+  auto second_or = ValidatorFactory::New(store);
+  ASSERT_TRUE(second_or.ok()) << second_or.status();
+  auto second = std::move(second_or).value();
+  EXPECT_EQ(second->store(), store);
+  first.reset();
+  conformance::cases::StringContains str_contains;
+  str_contains.set_val("somethingwithout");
+  google::protobuf::Arena arena;
+  auto validator = second->NewValidator(&arena, false);
+  auto violations_or = validator.Validate(str_contains);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+  // The second factory reused the programs of the first, which outlive it, and parsed nothing.
+  EXPECT_EQ(store->ProgramCount(), programs);
+  EXPECT_EQ(store->ParseCount(), parses);
+}
+
+TEST(ValidatorTest, Reload) {
+  // Without lazy loading, each generation only knows the types it was reloaded with.
+  auto factory_or = ReloadingValidatorFactory::New(
+      nullptr, [](ValidatorFactory& generation) { generation.DisableLazyLoading(); });
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  EXPECT_EQ(factory->generation(), 0);
+  google::protobuf::Arena arena;
+  auto before = factory->NewValidator(&arena, false);
+  std::weak_ptr<ValidatorFactory> initial = factory->Current();
+
+  auto status = factory->Reload({conformance::cases::StringContains::descriptor()->file()});
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(factory->generation(), 1);
+  auto first = factory->Current();
+  EXPECT_NE(first, initial.lock());
+
+  conformance::cases::StringContains str_contains;
+  str_contains.set_val("somethingwithout");
+  auto after = factory->NewValidator(&arena, false);
+  auto violations_or = after.Validate(str_contains);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+  // A validator created before the reload keeps using the initial generation, which it keeps
+  // alive, and which has no rules for the type.
+  EXPECT_FALSE(initial.expired());
+  violations_or = before.Validate(str_contains);
+  EXPECT_EQ(violations_or.status().code(), absl::StatusCode::kNotFound);
+
+  // Reloading the same files again compiles nothing new: the unchanged types keep their rules.
+  const auto& store = first->store();
+  size_t programs = store->ProgramCount();
+  size_t compiles = store->TypeCompileCount();
+  EXPECT_GT(compiles, 0);
+  status = factory->Reload({conformance::cases::StringContains::descriptor()->file()});
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(factory->generation(), 2);
+  EXPECT_NE(factory->Current(), first);
+  EXPECT_EQ(factory->Current()->store(), store);
+  EXPECT_EQ(store->ProgramCount(), programs);
+  EXPECT_EQ(store->TypeCompileCount(), compiles);
+  violations_or = factory->NewValidator(&arena, false).Validate(str_contains);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  EXPECT_EQ(violations_or.value().violations_size(), 1);
+
+  // Rules compiled with other settings are not reused, but their programs still are.
+  status = factory->Reload(
+      {conformance::cases::StringContains::descriptor()->file()},
+      nullptr,
+      [](ValidatorFactory& generation) { generation.SetAllowUnknownFields(true); });
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(store->TypeCompileCount(), 2 * compiles);
+  EXPECT_EQ(store->ProgramCount(), programs);
+}
+
+TEST(ValidatorTest, ReloadDynamicPool) {
+  int configured = 0;
+  auto factory_or = ReloadingValidatorFactory::New(nullptr, [&configured](ValidatorFactory& f) {
+    configured++;
+    f.DisableLazyLoading();
+    f.SetMaxDepth(8);
+  });
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  EXPECT_EQ(configured, 1);
+
+  struct DynamicPool {
+    google::protobuf::DescriptorPool pool;
+    google::protobuf::DynamicMessageFactory messages{&pool};
+  };
+  auto dynamic = std::make_shared<DynamicPool>();
+  const auto* generated = conformance::cases::StringContains::descriptor()->file();
+  copyFile(generated, dynamic->pool);
+  const auto* file = dynamic->pool.FindFileByName(generated->name());
+  ASSERT_NE(file, nullptr);
+  int generationConfigured = 0;
+  auto status = factory->Reload({file}, dynamic, [&](ValidatorFactory& f) {
+    generationConfigured++;
+    f.SetMessageFactory(&dynamic->messages, &dynamic->pool);
+    f.SetAllowUnknownFields(true);
+  });
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(factory->generation(), 1);
+  EXPECT_EQ(configured, 2);
+  EXPECT_EQ(generationConfigured, 1);
+
+  const auto* desc = dynamic->pool.FindMessageTypeByName(
+      conformance::cases::StringContains::descriptor()->full_name());
+  ASSERT_NE(desc, nullptr);
+  google::protobuf::Arena arena;
+  auto* message = dynamic->messages.GetPrototype(desc)->New(&arena);
+  message->GetReflection()->SetString(message, desc->FindFieldByName("val"), "somethingwithout");
+  auto validator = factory->NewValidator(&arena, false);
+  auto violations_or = validator.Validate(*message);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+
+  // The generation inherited DisableLazyLoading: types outside of the reloaded files are not
+  // compiled on demand.
+  violations_or = validator.Validate(conformance::cases::BytesContains());
+  EXPECT_EQ(violations_or.status().code(), absl::StatusCode::kNotFound);
+}
+
+TEST(ValidatorTest, MemoryBudget) {
+  google::protobuf::Arena arena;
+  conformance::cases::Message message;
+  conformance::cases::StringContains str_contains;
+  str_contains.set_val("somethingwithout");
+  conformance::cases::StringPrefix str_prefix;
+  str_prefix.set_val("bar");
+
+  // Measure the types without a budget first.
+  auto measure_or = ValidatorFactory::New();
+  ASSERT_TRUE(measure_or.ok()) << measure_or.status();
+  auto measure = std::move(measure_or).value();
+  auto measureValidator = measure->NewValidator(&arena, false);
+  ASSERT_TRUE(measureValidator.Validate(message).ok());
+  ASSERT_TRUE(measureValidator.Validate(str_contains).ok());
+  ASSERT_TRUE(measureValidator.Validate(str_prefix).ok());
+  auto sizes = measure->MemoryUsage();
+  size_t containsBytes = sizes[conformance::cases::StringContains::descriptor()];
+  size_t prefixBytes = sizes[conformance::cases::StringPrefix::descriptor()];
+  ASSERT_GT(containsBytes, 0);
+  ASSERT_GT(prefixBytes, 0);
+
+  // One of the two lazily loaded types fits in the budget, but not both.
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  factory->SetMemoryBudget(std::max(containsBytes, prefixBytes));
+  ASSERT_TRUE(factory->Add(conformance::cases::BytesContains::descriptor()).ok());
+  auto validator = factory->NewValidator(&arena, false);
+  auto expectViolation = [&validator](const google::protobuf::Message& msg, const char* ruleId) {
+    auto violations_or = validator.Validate(msg);
+    ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+    ASSERT_EQ(violations_or.value().violations_size(), 1);
+    EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), ruleId);
+  };
+
+  expectViolation(str_contains, "string.contains");
+  EXPECT_TRUE(factory->MemoryUsage().contains(conformance::cases::StringContains::descriptor()));
+  // Loading a second type evicts the least recently used one.
+  expectViolation(str_prefix, "string.prefix");
+  auto usage = factory->MemoryUsage();
+  EXPECT_FALSE(usage.contains(conformance::cases::StringContains::descriptor()));
+  EXPECT_TRUE(usage.contains(conformance::cases::StringPrefix::descriptor()));
+  // The evicted type is compiled again on its next use, evicting the other one in turn.
+  expectViolation(str_contains, "string.contains");
+  usage = factory->MemoryUsage();
+  EXPECT_TRUE(usage.contains(conformance::cases::StringContains::descriptor()));
+  EXPECT_FALSE(usage.contains(conformance::cases::StringPrefix::descriptor()));
+  // The explicitly added type was kept throughout.
+  EXPECT_GT(usage[conformance::cases::BytesContains::descriptor()], 0);
+
+  // Adding a type that was already loaded lazily pins it along with every type it references,
+  // even those that were never loaded.
+  auto pinned_or = ValidatorFactory::New();
+  ASSERT_TRUE(pinned_or.ok()) << pinned_or.status();
+  auto pinned = std::move(pinned_or).value();
+  pinned->SetMemoryBudget(sizes[conformance::cases::Message::descriptor()]);
+  auto pinnedValidator = pinned->NewValidator(&arena, false);
+  ASSERT_TRUE(pinnedValidator.Validate(message).ok());
+  usage = pinned->MemoryUsage();
+  ASSERT_TRUE(usage.contains(conformance::cases::Message::descriptor()));
+  EXPECT_FALSE(usage.contains(conformance::cases::TestMsg::descriptor()));
+  ASSERT_TRUE(pinned->Add(conformance::cases::Message::descriptor()).ok());
+  EXPECT_TRUE(pinned->MemoryUsage().contains(conformance::cases::TestMsg::descriptor()));
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(pinnedValidator.Validate(str_contains).ok());
+    ASSERT_TRUE(pinnedValidator.Validate(str_prefix).ok());
+  }
+  usage = pinned->MemoryUsage();
+  EXPECT_TRUE(usage.contains(conformance::cases::Message::descriptor()));
+  EXPECT_TRUE(usage.contains(conformance::cases::TestMsg::descriptor()));
+}
+
+TEST(ValidatorTest, ConcurrentEviction) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  // Every load evicts, so rules are routinely evicted while other threads still use them.
+  factory->SetMemoryBudget(1);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&factory] {
+      conformance::cases::StringContains str_contains;
+      str_contains.set_val("somethingwithout");
+      conformance::cases::StringPrefix str_prefix;
+      str_prefix.set_val("bar");
+      google::protobuf::Arena arena;
+      auto validator = factory->NewValidator(&arena, false);
+      for (int j = 0; j < 64; j++) {
+        auto violations_or = validator.Validate(str_contains);
+        ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+        ASSERT_EQ(violations_or.value().violations_size(), 1);
+        EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.contains");
+        violations_or = validator.Validate(str_prefix);
+        ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+        ASSERT_EQ(violations_or.value().violations_size(), 1);
+        EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "string.prefix");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+class FixedClock : public Clock {
+ public:
+  explicit FixedClock(absl::Time now) : now_(now) {}
+
+  absl::Time Now() const override {
+    reads_++;
+    return now_;
+  }
+
+  [[nodiscard]] int reads() const { return reads_; }
+
+ private:
+  absl::Time now_;
+  mutable std::atomic<int> reads_{0};
+};
+
+TEST(ValidatorTest, Clock) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  auto past = std::make_shared<FixedClock>(absl::FromUnixSeconds(1000));
+  factory->SetClock(past);
+  conformance::cases::TimestampLTNow lt_now;
+  lt_now.mutable_val()->set_seconds(2000);
+  google::protobuf::Arena arena;
+  auto validator = factory->NewValidator(&arena, false);
+  auto violations_or = validator.Validate(lt_now);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().rule_id(), "timestamp.lt_now");
+  // Both the native check and the CEL evaluation that produced the violation used `now`, but the
+  // clock was read once.
+  EXPECT_EQ(past->reads(), 1);
+  // Each call takes a snapshot of its own.
+  ASSERT_TRUE(validator.Validate(lt_now).ok());
+  EXPECT_EQ(past->reads(), 2);
+  // A factory clock is shared by the factory's validators.
+  auto other = factory->NewValidator(&arena, false);
+  ASSERT_TRUE(other.Validate(lt_now).ok());
+  EXPECT_EQ(past->reads(), 3);
+
+  FixedClock future(absl::FromUnixSeconds(3000));
+  validator.SetClock(&future);
+  violations_or = validator.Validate(lt_now);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  EXPECT_EQ(violations_or.value().violations_size(), 0);
+  EXPECT_EQ(past->reads(), 3);
+  EXPECT_EQ(future.reads(), 1);
+
+  // Rules that do not use `now` never read the clock, not even when evaluated in CEL.
+  conformance::cases::StringContains str_contains;
+  str_contains.set_val("somethingwithout");
+  violations_or = validator.Validate(str_contains);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(future.reads(), 1);
+}
+
+TEST(ValidatorTest, DeepNesting) {
+  google::protobuf::Arena arena;
+  auto* root = google::protobuf::Arena::Create<conformance::cases::TestMsg>(&arena);
+  auto* message = root;
+  for (int i = 0; i < 10000; i++) {
+    message->set_const_("foo");
+    message = message->mutable_nested();
+  }
+  message->set_const_("bar");
+
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  auto validator = factory->NewValidator(&arena, false);
+  auto violations_or = validator.Validate(*root);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  const auto& violation = violations_or.value().violations(0).proto();
+  EXPECT_EQ(violation.rule_id(), "string.const");
+  ASSERT_EQ(violation.field().elements_size(), 10001);
+  EXPECT_EQ(violation.field().elements(0).field_name(), "nested");
+  EXPECT_EQ(violation.field().elements(10000).field_name(), "const");
+
+  auto limited_or = ValidatorFactory::New();
+  ASSERT_TRUE(limited_or.ok()) << limited_or.status();
+  auto limited = std::move(limited_or).value();
+  limited->SetMaxDepth(100);
+  auto limitedValidator = limited->NewValidator(&arena, false);
+  violations_or = limitedValidator.Validate(*root);
+  EXPECT_EQ(violations_or.status().code(), absl::StatusCode::kInvalidArgument);
+  violations_or = limitedValidator.Validate(root->nested());
+  EXPECT_EQ(violations_or.status().code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_TRUE(limitedValidator.Validate(conformance::cases::TestMsg()).ok());
+
+  // Fields of the validated message are at depth 1, so 100 levels of nesting are within the
+  // limit, and the violation at the bottom is still reported, while 101 levels are not.
+  conformance::cases::TestMsg chain;
+  message = &chain;
+  for (int i = 0; i < 100; i++) {
+    message->set_const_("foo");
+    message = message->mutable_nested();
+  }
+  message->set_const_("bar");
+  violations_or = limitedValidator.Validate(chain);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().field().elements_size(), 101);
+  message->set_const_("foo");
+  message->mutable_nested();
+  violations_or = limitedValidator.Validate(chain);
+  EXPECT_EQ(violations_or.status().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(ValidatorTest, NewValidatorFor) {
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  factory->DisableLazyLoading();
+  google::protobuf::Arena arena;
+  auto validator_or = factory->NewValidatorFor(conformance::cases::Message::descriptor(), &arena);
+  ASSERT_TRUE(validator_or.ok()) << validator_or.status();
+  auto validator = std::move(validator_or).value();
+  // The root and every type it descends into were compiled up front.
+  auto usage = factory->MemoryUsage();
+  EXPECT_TRUE(usage.contains(conformance::cases::Message::descriptor()));
+  EXPECT_TRUE(usage.contains(conformance::cases::TestMsg::descriptor()));
+  // Linking the same root again reuses the compiled rules.
+  auto programs = factory->store()->ProgramCount();
+  ASSERT_TRUE(factory->NewValidatorFor(conformance::cases::Message::descriptor(), &arena).ok());
+  EXPECT_EQ(factory->store()->ProgramCount(), programs);
+
+  conformance::cases::Message message;
+  message.mutable_val()->set_const_("bar");
+  message.mutable_val()->mutable_nested()->set_const_("foo");
+  auto violations_or = validator.Validate(message);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  const auto& violation = violations_or.value().violations(0).proto();
+  EXPECT_EQ(violation.rule_id(), "string.const");
+  ASSERT_EQ(violation.field().elements_size(), 2);
+  EXPECT_EQ(violation.field().elements(0).field_name(), "val");
+  EXPECT_EQ(violation.field().elements(1).field_name(), "const");
+
+  // The linked types were added to the factory, so they can be validated on their own, by any of
+  // its validators, even though lazy loading is disabled.
+  auto plainValidator = factory->NewValidator(&arena, false);
+  violations_or = plainValidator.Validate(message);
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  EXPECT_EQ(violations_or.value().violations_size(), 1);
+  violations_or = validator.Validate(message.val());
+  ASSERT_TRUE(violations_or.ok()) << violations_or.status();
+  ASSERT_EQ(violations_or.value().violations_size(), 1);
+  EXPECT_EQ(violations_or.value().violations(0).proto().field().elements_size(), 1);
+
+  // Messages of other types are looked up as usual, and with lazy loading disabled, not found.
+  conformance::cases::StringContains str_contains;
+  violations_or = validator.Validate(str_contains);
+  EXPECT_EQ(violations_or.status().code(), absl::StatusCode::kNotFound);
+}
+
+TEST(ValidatorTest, ConcurrentNewValidatorFor) {
+  const std::vector<const google::protobuf::Descriptor*> roots{
+      conformance::cases::Message::descriptor(),
+      conformance::cases::StringContains::descriptor()};
+  // Link the roots on one thread first, to count the types they compile.
+  auto reference_or = ValidatorFactory::New();
+  ASSERT_TRUE(reference_or.ok()) << reference_or.status();
+  auto reference = std::move(reference_or).value();
+  google::protobuf::Arena arena;
+  for (const auto* root : roots) {
+    ASSERT_TRUE(reference->NewValidatorFor(root, &arena).ok());
+  }
+
+  auto factory_or = ValidatorFactory::New();
+  ASSERT_TRUE(factory_or.ok()) << factory_or.status();
+  auto factory = std::move(factory_or).value();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&factory, root = roots[i % roots.size()]] {
+      google::protobuf::Arena arena;
+      auto validator_or = factory->NewValidatorFor(root, &arena);
+      ASSERT_TRUE(validator_or.ok()) << validator_or.status();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // Every type was compiled once, however many threads linked it at the same time.
+  EXPECT_EQ(factory->store()->TypeCompileCount(), reference->store()->TypeCompileCount());
+}
+
+TEST(ValidatorTest, DefaultStore) {
+  auto first_or = ValidatorFactory::New();
+  ASSERT_TRUE(first_or.ok()) << first_or.status();
+  auto first = std::move(first_or).value();
+  auto second_or = ValidatorFactory::New();
+  ASSERT_TRUE(second_or.ok()) << second_or.status();
+  auto second = std::move(second_or).value();
+  // Each factory has caches of its own.
+  EXPECT_NE(first->store(), second->store());
+  ASSERT_TRUE(first->Add(conformance::cases::StringContains::descriptor()).ok());
+  EXPECT_GT(first->store()->ProgramCount(), 0);
+  EXPECT_EQ(second->store()->ProgramCount(), 0);
+  EXPECT_NE(first->SaveSnapshot(), second->SaveSnapshot());
+  // The shared builders cannot be reconfigured by one of the factories using them.
+  EXPECT_EQ(
+      first->store()->SetRegexMaxMemory(1 << 20).code(), absl::StatusCode::kFailedPrecondition);
+  auto own_or = CompiledRuleStore::New();
+  ASSERT_TRUE(own_or.ok()) << own_or.status();
+  EXPECT_TRUE(own_or.value()->SetRegexMaxMemory(1 << 20).ok());
+
+  // Releasing a factory releases its caches.
+  std::weak_ptr<CompiledRuleStore> store = first->store();
+  first.reset();
+  EXPECT_TRUE(store.expired());
+}
+
 } // namespace
 } // namespace buf::validate
@@ -57,7 +57,7 @@ if(PROTOVALIDATE_CC_ENABLE_TESTS OR CEL_CPP_ENABLE_TESTS)
     endif()
 endif()
 
-if(CEL_CPP_ENABLE_TESTS)
+if(CEL_CPP_ENABLE_TESTS OR PROTOVALIDATE_CC_ENABLE_BENCHMARKS)
     # Google Benchmark
     if(TARGET benchmark::benchmark)
         message(STATUS "protovalidate-cc: Using pre-existing google benchmark targets")